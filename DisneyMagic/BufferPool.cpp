@@ -0,0 +1,71 @@
+#include "BufferPool.h"
+#include <iterator>
+
+namespace curlhelpers
+{
+
+BufferPool::BufferPool(size_t max_retained_bytes)
+    :   max_retained_bytes(max_retained_bytes),
+        mutex(),
+        idle(),
+        retained_bytes(0),
+        stats()
+{}
+
+std::string BufferPool::Acquire(size_t expected_size)
+{
+    std::string buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.acquired;
+        auto found = expected_size > 0 ? idle.lower_bound(expected_size) : idle.end();
+        if (expected_size == 0 && !idle.empty())
+        {
+            found = std::prev(idle.end());
+        }
+        if (found != idle.end())
+        {
+            buffer = std::move(found->second);
+            retained_bytes -= found->first;
+            idle.erase(found);
+            ++stats.reused;
+            return buffer;
+        }
+        if (expected_size > 0)
+        {
+            ++stats.allocations;
+        }
+    }
+    buffer.reserve(expected_size);
+    return buffer;
+}
+
+void BufferPool::Recycle(std::string buffer)
+{
+    size_t capacity = buffer.capacity();
+    buffer.clear();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // small strings live inside the object and are not worth keeping
+    if (capacity <= std::string().capacity() || retained_bytes + capacity > max_retained_bytes)
+    {
+        return;
+    }
+    idle.emplace(capacity, std::move(buffer));
+    retained_bytes += capacity;
+    ++stats.recycled;
+}
+
+void BufferPool::CountGrowth()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.allocations;
+}
+
+BufferStats BufferPool::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+}
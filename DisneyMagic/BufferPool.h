@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace curlhelpers
+{
+
+struct BufferStats
+{
+    uint64_t acquired { 0 };
+    // acquisitions served by a recycled buffer
+    uint64_t reused { 0 };
+    // heap allocations for bodies: new buffers plus buffers that had to grow while a body arrived
+    uint64_t allocations { 0 };
+    uint64_t recycled { 0 };
+};
+
+// Keeps the strings response bodies are received into once their contents
+// have been consumed, so in steady state a body lands in a buffer that is
+// already large enough instead of growing a new one a chunk at a time.
+// Safe to use from any thread.
+class BufferPool
+{
+public:
+    explicit BufferPool(size_t max_retained_bytes = 16 * 1024 * 1024);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Returns an empty buffer with room for at least expected_size bytes, or
+    // the largest one available when the size is not known (zero).
+    std::string Acquire(size_t expected_size);
+    // Takes back a buffer whose contents are no longer needed.
+    void Recycle(std::string buffer);
+    // Counts a buffer that reallocated while a body of unknown size arrived.
+    void CountGrowth();
+
+    BufferStats GetStats() const;
+
+private:
+    size_t max_retained_bytes;
+    mutable std::mutex mutex;
+    // idle buffers by capacity
+    std::multimap<size_t, std::string> idle;
+    size_t retained_bytes;
+    BufferStats stats;
+};
+
+}
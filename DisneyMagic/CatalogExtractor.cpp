@@ -0,0 +1,339 @@
+#include "CatalogExtractor.h"
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <rapidjson/error/en.h>
+#include <rapidjson/reader.h>
+
+namespace disneymagic
+{
+
+namespace
+{
+
+// Stands for any key in a field path; the key it matched is handed back.
+constexpr const char* kAnyKey { "*" };
+// Stands for the elements of an array in a path.
+constexpr const char* kArrayElement { "[]" };
+
+// A path of keys below some object, fixed at compile time.
+template <size_t Length>
+using FieldPath = std::array<const char*, Length>;
+
+// Where the sets are in each kind of document.
+constexpr FieldPath<5> kHomeSetPath { "data", "StandardCollection", "containers", kArrayElement, "set" };
+constexpr FieldPath<2> kSetDocumentPath { "data", kAnyKey };
+
+// Fields of a set, below the set object.
+constexpr FieldPath<1> kSetRefId { "refId" };
+constexpr FieldPath<6> kSetTitle { "text", "title", "full", "set", "default", "content" };
+constexpr FieldPath<2> kSetItems { "items", kArrayElement };
+
+// Fields of an item, below the item object. Titles and images come in one
+// variant per content type, which the any key captures.
+constexpr FieldPath<1> kItemType { "type" };
+constexpr FieldPath<6> kItemTitle { "text", "title", "full", kAnyKey, "default", "content" };
+constexpr FieldPath<6> kItemImage { "image", "tile", "1.78", kAnyKey, "default", "url" };
+
+// What an item has shown so far; any of it may be missing from a bad payload.
+struct ItemFields
+{
+    std::optional<std::string_view> type;
+    // variants seen so far, since the type may come after them
+    std::vector<std::pair<std::string_view, std::string_view>> titles;
+    std::vector<std::pair<std::string_view, std::string_view>> image_urls;
+};
+
+// Follows the path from the document root to the current value and binds
+// the string values at the field paths above as they stream past, so each
+// item is read in one pass without looking anything up. Values of the wrong
+// type or in the wrong place are ignored and the item is skipped if it ends
+// up without a type or an image.
+template <size_t SetDepth>
+class CatalogHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, CatalogHandler<SetDepth>>
+{
+public:
+    CatalogHandler(const FieldPath<SetDepth>& set_path, std::vector<std::string_view>& path, ItemFields& item)
+        :   set_path(set_path),
+            path(path),
+            in_set(false),
+            container(),
+            item(item),
+            containers()
+    {
+        path.clear();
+    }
+
+    bool StartObject()
+    {
+        if (AtSet())
+        {
+            container = CatalogContainer();
+            in_set = true;
+        }
+        else if (AtItem())
+        {
+            item.type.reset();
+            item.titles.clear();
+            item.image_urls.clear();
+        }
+        path.emplace_back();
+        return true;
+    }
+
+    // parsing in place, keys and strings point into the document buffer and outlive the parse
+    bool Key(const char* key, rapidjson::SizeType length, bool)
+    {
+        path.back() = std::string_view(key, length);
+        return true;
+    }
+
+    bool EndObject(rapidjson::SizeType)
+    {
+        path.pop_back();
+        if (AtSet())
+        {
+            containers.push_back(std::move(container));
+            in_set = false;
+        }
+        else if (AtItem())
+        {
+            FinishItem();
+        }
+        return true;
+    }
+
+    bool StartArray()
+    {
+        path.emplace_back(kArrayElement);
+        return true;
+    }
+
+    bool EndArray(rapidjson::SizeType)
+    {
+        path.pop_back();
+        return true;
+    }
+
+    bool String(const char* value, rapidjson::SizeType length, bool)
+    {
+        if (!in_set)
+        {
+            return true;
+        }
+
+        std::string_view text(value, length);
+        if (InItem())
+        {
+            std::optional<std::string_view> variant;
+            if (Match(kItemDepth, kItemType))
+            {
+                item.type = text;
+            }
+            else if ((variant = Match(kItemDepth, kItemTitle)))
+            {
+                item.titles.emplace_back(*variant, text);
+            }
+            else if ((variant = Match(kItemDepth, kItemImage)))
+            {
+                item.image_urls.emplace_back(*variant, text);
+            }
+        }
+        else if (Match(SetDepth, kSetRefId))
+        {
+            container.ref_id = text;
+        }
+        else if (Match(SetDepth, kSetTitle))
+        {
+            container.title = text;
+        }
+        return true;
+    }
+
+    std::vector<CatalogContainer>& Containers()
+    {
+        return containers;
+    }
+
+private:
+    static constexpr size_t kItemDepth { SetDepth + kSetItems.size() };
+
+    // Matches the path from the given depth on against the pattern, giving
+    // back the key matched by kAnyKey, or an empty key if there is none.
+    template <size_t Length>
+    std::optional<std::string_view> Match(size_t from, const FieldPath<Length>& pattern) const
+    {
+        if (path.size() != from + Length)
+        {
+            return std::nullopt;
+        }
+        std::string_view any_key;
+        for (size_t index = 0; index < Length; ++index)
+        {
+            if (pattern[index] == kAnyKey)
+            {
+                any_key = path[from + index];
+            }
+            else if (path[from + index] != pattern[index])
+            {
+                return std::nullopt;
+            }
+        }
+        return any_key;
+    }
+
+    // True for the set object itself.
+    bool AtSet() const
+    {
+        return Match(0, set_path).has_value();
+    }
+
+    // True for an element of the set's items array.
+    bool AtItem() const
+    {
+        return in_set && Match(SetDepth, kSetItems).has_value();
+    }
+
+    // True anywhere inside an element of the set's items array.
+    bool InItem() const
+    {
+        return in_set && path.size() > kItemDepth && path[SetDepth] == kSetItems[0] && path[SetDepth + 1] == kSetItems[1];
+    }
+
+    // The type decides which of the title and image variants belong to the item.
+    void FinishItem()
+    {
+        if (!item.type)
+        {
+            return;
+        }
+        const char* variant = nullptr;
+        const char* image_variant = nullptr;
+        if (*item.type == "DmcSeries")
+        {
+            variant = "series";
+            image_variant = "series";
+        }
+        else if (*item.type == "DmcVideo")
+        {
+            variant = "program";
+            image_variant = "program";
+        }
+        else if (*item.type == "StandardCollection")
+        {
+            variant = "collection";
+            image_variant = "default";
+        }
+        if (variant == nullptr)
+        {
+            return;
+        }
+
+        CatalogItem found;
+        for (const auto& title : item.titles)
+        {
+            if (title.first == variant)
+            {
+                found.title = title.second;
+            }
+        }
+        for (const auto& image_url : item.image_urls)
+        {
+            if (image_url.first == image_variant)
+            {
+                found.image_url = image_url.second;
+            }
+        }
+        if (!found.image_url.empty())
+        {
+            container.items.push_back(found);
+        }
+    }
+
+    FieldPath<SetDepth> set_path;
+    // the key of each enclosing object, or kArrayElement for arrays
+    std::vector<std::string_view>& path;
+    // true between the start and end of a set object
+    bool in_set;
+    CatalogContainer container;
+    ItemFields& item;
+    std::vector<CatalogContainer> containers;
+};
+
+template <size_t SetDepth>
+std::vector<CatalogContainer> extract(
+    rapidjson::Reader& reader,
+    std::vector<std::string_view>& path,
+    ItemFields& item,
+    std::string& json,
+    const FieldPath<SetDepth>& set_path)
+{
+    CatalogHandler<SetDepth> handler(set_path, path, item);
+    rapidjson::InsituStringStream stream(&json[0]);
+    rapidjson::ParseResult result = reader.Parse<rapidjson::kParseInsituFlag>(stream, handler);
+    if (!result)
+    {
+        throw std::runtime_error(std::string("Failed to parse catalog JSON: ") + rapidjson::GetParseError_En(result.Code()));
+    }
+    return std::move(handler.Containers());
+}
+
+}
+
+// Kept between documents so that in steady state extraction only allocates the records.
+struct CatalogExtractor::Scratch
+{
+    rapidjson::Reader reader;
+    std::vector<std::string_view> path;
+    ItemFields item;
+};
+
+Catalog::Catalog()
+    :   buffer(std::make_unique<std::string>()),
+        mapping(),
+        containers()
+{}
+
+const std::vector<CatalogContainer>& Catalog::Containers() const
+{
+    return containers;
+}
+
+std::string Catalog::Release()
+{
+    containers.clear();
+    mapping.reset();
+    std::string released = std::move(*buffer);
+    buffer->clear();
+    return released;
+}
+
+CatalogExtractor::CatalogExtractor()
+    :   scratch(std::make_unique<Scratch>())
+{}
+
+CatalogExtractor::~CatalogExtractor() = default;
+
+Catalog CatalogExtractor::ExtractHome(std::string json)
+{
+    Catalog catalog;
+    *catalog.buffer = std::move(json);
+    catalog.containers = extract(scratch->reader, scratch->path, scratch->item, *catalog.buffer, kHomeSetPath);
+    return catalog;
+}
+
+Catalog CatalogExtractor::ExtractSet(std::string json)
+{
+    Catalog catalog;
+    *catalog.buffer = std::move(json);
+    catalog.containers = extract(scratch->reader, scratch->path, scratch->item, *catalog.buffer, kSetDocumentPath);
+    if (catalog.containers.empty())
+    {
+        throw std::runtime_error("Set document has no set");
+    }
+    catalog.containers.resize(1);
+    return catalog;
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace disneymagic
+{
+
+// The strings point into the buffer of the Catalog the record came from.
+struct CatalogItem
+{
+    std::string_view title;
+    std::string_view image_url;
+};
+
+struct CatalogContainer
+{
+    std::string_view title;
+    // set for SetRef containers, whose items come from a separate set document
+    std::string_view ref_id;
+    std::vector<CatalogItem> items;
+};
+
+// Owns a parsed document buffer, or a mapped snapshot, together with the
+// records that point into it, so the records stay valid for as long as the
+// catalog does.
+class Catalog
+{
+public:
+    Catalog();
+
+    Catalog(const Catalog&) = delete;
+    Catalog& operator=(const Catalog&) = delete;
+    Catalog(Catalog&&) = default;
+    Catalog& operator=(Catalog&&) = default;
+
+    const std::vector<CatalogContainer>& Containers() const;
+
+    // Hands the buffer back, for instance to recycle it, and empties the catalog.
+    std::string Release();
+
+private:
+    friend class CatalogExtractor;
+    friend class CatalogSnapshot;
+
+    // held by pointer so that moving the catalog never moves the characters,
+    // which a short string kept in place would
+    std::unique_ptr<std::string> buffer;
+    // set instead of the buffer for a catalog loaded from a snapshot
+    std::shared_ptr<const char> mapping;
+    std::vector<CatalogContainer> containers;
+};
+
+// Pulls the few fields the home screen shows out of the home API and set
+// documents in a single streaming pass with rapidjson::Reader, without
+// building a DOM. The document is parsed in place: strings are unescaped
+// inside the buffer, which the returned catalog takes over, so nothing is
+// copied out of it. Items are matched by their type: DmcSeries, DmcVideo and
+// StandardCollection. Malformed JSON throws std::runtime_error.
+// An extractor keeps its working state between documents, so a thread that
+// extracts many of them reuses one; it is not safe to share between threads.
+class CatalogExtractor
+{
+public:
+    CatalogExtractor();
+    ~CatalogExtractor();
+
+    CatalogExtractor(const CatalogExtractor&) = delete;
+    CatalogExtractor& operator=(const CatalogExtractor&) = delete;
+
+    // Reads data.StandardCollection.containers from the home API.
+    Catalog ExtractHome(std::string json);
+    // Reads the set under data in a set document into a single container.
+    Catalog ExtractSet(std::string json);
+
+private:
+    struct Scratch;
+
+    std::unique_ptr<Scratch> scratch;
+};
+
+}
@@ -0,0 +1,352 @@
+#include "CatalogSnapshot.h"
+#include "DiskCache.h"
+#include "SetResolver.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace disneymagic
+{
+
+namespace
+{
+
+// "DMCS" read as a little-endian word; a snapshot from a machine of the other byte order fails it.
+const uint32_t kSnapshotMagic { 0x53434d44 };
+// Bump whenever the layout or the meaning of a field changes.
+const uint32_t kSnapshotVersion { 1 };
+
+// The file is the header, then the container records, the item records and
+// the string block, all of them 32-bit words in host byte order.
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t container_count;
+    uint32_t item_count;
+    uint32_t strings_size;
+};
+
+// A string in the string block.
+struct SnapshotString
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotContainer
+{
+    SnapshotString title;
+    // empty unless the set could not be fetched, in which case the row fetches it at launch
+    SnapshotString ref_id;
+    uint32_t first_item;
+    uint32_t item_count;
+};
+
+struct SnapshotItem
+{
+    SnapshotString title;
+    SnapshotString image_url;
+};
+
+// Collects the strings of a snapshot, storing each distinct one once.
+class StringBlock
+{
+public:
+    SnapshotString Add(std::string_view text)
+    {
+        auto found = offsets.find(text);
+        if (found != offsets.end())
+        {
+            return SnapshotString { found->second, static_cast<uint32_t>(text.size()) };
+        }
+        uint32_t offset = static_cast<uint32_t>(block.size());
+        block.append(text.data(), text.size());
+        // keyed by the caller's view, which outlives the block
+        offsets.emplace(text, offset);
+        return SnapshotString { offset, static_cast<uint32_t>(text.size()) };
+    }
+
+    const std::string& Contents() const
+    {
+        return block;
+    }
+
+private:
+    std::string block;
+    std::unordered_map<std::string_view, uint32_t> offsets;
+};
+
+bool in_block(const SnapshotString& text, uint32_t strings_size)
+{
+    return text.offset <= strings_size && text.length <= strings_size - text.offset;
+}
+
+}
+
+bool CatalogSnapshot::Load(const std::string& path, Catalog& catalog)
+{
+    if (path.empty())
+    {
+        return false;
+    }
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || static_cast<uint64_t>(status.st_size) < sizeof(SnapshotHeader))
+    {
+        close(file);
+        return false;
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    std::shared_ptr<const char> mapping(static_cast<const char*>(mapped), [size](const char* data)
+    {
+        munmap(const_cast<char*>(data), size);
+    });
+
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(mapping.get());
+    if (header->magic != kSnapshotMagic || header->version != kSnapshotVersion)
+    {
+        return false;
+    }
+    uint64_t expected_size = sizeof(SnapshotHeader) +
+        static_cast<uint64_t>(header->container_count) * sizeof(SnapshotContainer) +
+        static_cast<uint64_t>(header->item_count) * sizeof(SnapshotItem) +
+        header->strings_size;
+    if (expected_size != size)
+    {
+        return false;
+    }
+
+    const SnapshotContainer* containers = reinterpret_cast<const SnapshotContainer*>(header + 1);
+    const SnapshotItem* items = reinterpret_cast<const SnapshotItem*>(containers + header->container_count);
+    const char* strings = reinterpret_cast<const char*>(items + header->item_count);
+    auto view = [strings](const SnapshotString& text) { return std::string_view(strings + text.offset, text.length); };
+
+    std::vector<CatalogContainer> loaded(header->container_count);
+    for (size_t index = 0; index < loaded.size(); ++index)
+    {
+        const SnapshotContainer& record = containers[index];
+        if (!in_block(record.title, header->strings_size) || !in_block(record.ref_id, header->strings_size) ||
+            record.first_item > header->item_count || record.item_count > header->item_count - record.first_item)
+        {
+            return false;
+        }
+        loaded[index].title = view(record.title);
+        loaded[index].ref_id = view(record.ref_id);
+        loaded[index].items.reserve(record.item_count);
+        for (uint32_t item = record.first_item; item < record.first_item + record.item_count; ++item)
+        {
+            if (!in_block(items[item].title, header->strings_size) || !in_block(items[item].image_url, header->strings_size))
+            {
+                return false;
+            }
+            loaded[index].items.push_back(CatalogItem { view(items[item].title), view(items[item].image_url) });
+        }
+    }
+
+    catalog.Release();
+    catalog.mapping = std::move(mapping);
+    catalog.containers = std::move(loaded);
+    return true;
+}
+
+bool CatalogSnapshot::Save(const std::string& path, const std::vector<CatalogContainer>& containers)
+{
+    StringBlock strings;
+    std::vector<SnapshotContainer> container_records;
+    std::vector<SnapshotItem> item_records;
+    container_records.reserve(containers.size());
+    for (const CatalogContainer& container : containers)
+    {
+        SnapshotContainer record;
+        record.title = strings.Add(container.title);
+        record.ref_id = strings.Add(container.ref_id);
+        record.first_item = static_cast<uint32_t>(item_records.size());
+        record.item_count = static_cast<uint32_t>(container.items.size());
+        container_records.push_back(record);
+        for (const CatalogItem& item : container.items)
+        {
+            item_records.push_back(SnapshotItem { strings.Add(item.title), strings.Add(item.image_url) });
+        }
+    }
+
+    SnapshotHeader header;
+    header.magic = kSnapshotMagic;
+    header.version = kSnapshotVersion;
+    header.container_count = static_cast<uint32_t>(container_records.size());
+    header.item_count = static_cast<uint32_t>(item_records.size());
+    header.strings_size = static_cast<uint32_t>(strings.Contents().size());
+
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(container_records.data()), container_records.size() * sizeof(SnapshotContainer));
+        file.write(reinterpret_cast<const char*>(item_records.data()), item_records.size() * sizeof(SnapshotItem));
+        file.write(strings.Contents().data(), strings.Contents().size());
+        if (!file)
+        {
+            std::remove(temp_path.c_str());
+            return false;
+        }
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+std::string CatalogSnapshot::DefaultPath()
+{
+    // offline runs leave the cache directory unset, and the snapshot with it
+    std::string cache_directory = curlhelpers::FetchEngine::DefaultConfig().cache_directory;
+    if (cache_directory.empty())
+    {
+        return std::string();
+    }
+    return cache_directory + "/catalog-snapshot";
+}
+
+CatalogRefresh::CatalogRefresh(const std::string& home_api_url, const std::string& snapshot_path)
+    :   home_api_url(home_api_url),
+        snapshot_path(snapshot_path),
+        mutex(),
+        outstanding(),
+        stopping(false),
+        thread()
+{
+    if (!snapshot_path.empty())
+    {
+        thread = std::thread(&CatalogRefresh::Run, this);
+    }
+}
+
+CatalogRefresh::~CatalogRefresh()
+{
+    std::vector<curlhelpers::RequestId> cancelling;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        cancelling.swap(outstanding);
+    }
+    // the engine completes a cancelled fetch at once, whether or not the
+    // transfer behind it goes on, so the thread is not left waiting on the network
+    for (curlhelpers::RequestId id : cancelling)
+    {
+        curlhelpers::FetchEngine::Instance().Cancel(id);
+    }
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void CatalogRefresh::Run()
+{
+    try
+    {
+        std::future<curlhelpers::FetchResult> home = Submit(home_api_url, curlhelpers::RequestKind::HomeApi);
+        if (!home.valid())
+        {
+            return;
+        }
+        curlhelpers::FetchResult home_result = home.get();
+        if (home_result.cancelled)
+        {
+            return;
+        }
+        if (!home_result.Succeeded())
+        {
+            throw std::runtime_error(home_result.error);
+        }
+
+        CatalogExtractor extractor;
+        Catalog home_catalog = extractor.ExtractHome(std::move(home_result.body));
+        std::vector<CatalogContainer> rows = home_catalog.Containers();
+
+        // every set is in flight at once; the engine coalesces those the rows are fetching themselves
+        std::vector<std::future<curlhelpers::FetchResult>> sets(rows.size());
+        for (size_t row = 0; row < rows.size(); ++row)
+        {
+            if (rows[row].ref_id.empty())
+            {
+                continue;
+            }
+            sets[row] = Submit(SetResolver::SetUrl(std::string(rows[row].ref_id)), curlhelpers::RequestKind::SetJson);
+            if (!sets[row].valid())
+            {
+                return;
+            }
+        }
+
+        // the set catalogs own the strings their rows point into until the snapshot is written
+        std::vector<Catalog> set_catalogs;
+        for (size_t row = 0; row < rows.size(); ++row)
+        {
+            if (!sets[row].valid())
+            {
+                continue;
+            }
+            curlhelpers::FetchResult result = sets[row].get();
+            if (result.cancelled)
+            {
+                return;
+            }
+            // a row whose set failed keeps its reference and fetches the set at launch
+            if (!result.Succeeded())
+            {
+                continue;
+            }
+            try
+            {
+                Catalog set = extractor.ExtractSet(std::move(result.body));
+                rows[row].items = set.Containers().front().items;
+                rows[row].ref_id = std::string_view();
+                set_catalogs.push_back(std::move(set));
+            }
+            catch(std::exception& e)
+            {
+                std::cout << e.what() << std::endl;
+            }
+        }
+
+        if (!CatalogSnapshot::Save(snapshot_path, rows))
+        {
+            std::cout << "Failed to write catalog snapshot " << snapshot_path << std::endl;
+        }
+    }
+    catch(std::exception& e)
+    {
+        std::cout << "Catalog refresh failed: " << e.what() << std::endl;
+    }
+}
+
+std::future<curlhelpers::FetchResult> CatalogRefresh::Submit(const std::string& url, curlhelpers::RequestKind kind)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping)
+    {
+        return std::future<curlhelpers::FetchResult>();
+    }
+    curlhelpers::RequestId id;
+    std::future<curlhelpers::FetchResult> result = curlhelpers::FetchEngine::Instance().Submit(url, kind, curlhelpers::FetchPriority::Prefetch, &id);
+    outstanding.push_back(id);
+    return result;
+}
+
+}
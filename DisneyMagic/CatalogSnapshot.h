@@ -0,0 +1,60 @@
+#pragma once
+
+#include "CatalogExtractor.h"
+#include "CurlHelpers.h"
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace disneymagic
+{
+
+// A compact binary copy of the catalog with the set documents already folded
+// into their rows, written after each refresh and mapped into memory at the
+// next launch. Strings are stored once in a block at the end, and the
+// container and item records refer to them by offset and length, so a loaded
+// catalog's records point straight into the mapping without any parsing.
+class CatalogSnapshot
+{
+public:
+    // Returns false, leaving the catalog alone, if the path is empty, there is
+    // no snapshot or it was written by another version or is damaged.
+    static bool Load(const std::string& path, Catalog& catalog);
+    // Writes to a temporary file and renames it into place, so a launch never
+    // maps half a snapshot. Returns false if the file could not be written.
+    static bool Save(const std::string& path, const std::vector<CatalogContainer>& containers);
+
+    // Empty for replayed and mirrored runs, which must neither depend on a
+    // snapshot from earlier runs nor overwrite the real one.
+    static std::string DefaultPath();
+};
+
+// Downloads the home API and every set it refers to on a thread of its own,
+// at prefetch priority so the visible tiles go first, and saves them as the
+// snapshot for the next launch. Destroying it cancels whatever is outstanding.
+// An empty snapshot path disables it.
+class CatalogRefresh
+{
+public:
+    CatalogRefresh(const std::string& home_api_url, const std::string& snapshot_path);
+    ~CatalogRefresh();
+
+    CatalogRefresh(const CatalogRefresh&) = delete;
+    CatalogRefresh& operator=(const CatalogRefresh&) = delete;
+
+private:
+    void Run();
+    // Returns no future once the refresh has been stopped.
+    std::future<curlhelpers::FetchResult> Submit(const std::string& url, curlhelpers::RequestKind kind);
+
+    std::string home_api_url;
+    std::string snapshot_path;
+    std::mutex mutex;
+    std::vector<curlhelpers::RequestId> outstanding;
+    bool stopping;
+    std::thread thread;
+};
+
+}
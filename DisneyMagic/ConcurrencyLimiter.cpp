@@ -0,0 +1,120 @@
+#include "ConcurrencyLimiter.h"
+#include <algorithm>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+const double kLatencySmoothing { 0.2 };
+// a throughput drop larger than this right after growing the window counts as congestion
+const double kThroughputDropTolerance { 0.8 };
+// first-byte inflation smaller than this is treated as noise regardless of the ratio
+const double kLatencySlackSeconds { 0.02 };
+
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(size_t floor, size_t ceiling, size_t initial, double decrease_factor, double latency_tolerance)
+    :   floor(std::max<size_t>(floor, 1)),
+        ceiling(std::max(ceiling, std::max<size_t>(floor, 1))),
+        decrease_factor(decrease_factor),
+        latency_tolerance(latency_tolerance),
+        mutex(),
+        window(static_cast<double>(std::clamp(initial, this->floor, this->ceiling))),
+        epoch_start(Clock::now()),
+        epoch_completions(0),
+        epoch_bytes(0),
+        epoch_failed(false),
+        epoch_saturated(false),
+        last_throughput(0),
+        stats()
+{
+    stats.window = static_cast<size_t>(window);
+}
+
+size_t ConcurrencyLimiter::Window() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<size_t>(window);
+}
+
+void ConcurrencyLimiter::OnSaturated()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    epoch_saturated = true;
+}
+
+void ConcurrencyLimiter::OnComplete(double first_byte_seconds, uint64_t bytes, bool failed)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed)
+    {
+        epoch_failed = true;
+    }
+    else if (first_byte_seconds > 0)
+    {
+        if (stats.min_first_byte_seconds == 0 || first_byte_seconds < stats.min_first_byte_seconds)
+        {
+            stats.min_first_byte_seconds = first_byte_seconds;
+        }
+        stats.smoothed_first_byte_seconds = stats.smoothed_first_byte_seconds == 0
+            ? first_byte_seconds
+            : stats.smoothed_first_byte_seconds + kLatencySmoothing * (first_byte_seconds - stats.smoothed_first_byte_seconds);
+    }
+
+    epoch_bytes += bytes;
+    if (++epoch_completions >= static_cast<size_t>(window))
+    {
+        Decide();
+    }
+}
+
+LimiterStats ConcurrencyLimiter::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void ConcurrencyLimiter::Decide()
+{
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - epoch_start).count();
+    double throughput = elapsed > 0 ? epoch_bytes / elapsed : 0;
+
+    bool latency_inflated = stats.min_first_byte_seconds > 0 &&
+        stats.smoothed_first_byte_seconds > stats.min_first_byte_seconds * latency_tolerance &&
+        stats.smoothed_first_byte_seconds - stats.min_first_byte_seconds > kLatencySlackSeconds;
+    bool throughput_dropped = epoch_saturated && stats.last_decision == LimiterDecision::Increase &&
+        last_throughput > 0 && throughput < last_throughput * kThroughputDropTolerance;
+
+    if (epoch_failed || latency_inflated || throughput_dropped)
+    {
+        window = std::max(static_cast<double>(floor), window * decrease_factor);
+        stats.last_decision = LimiterDecision::Decrease;
+        ++stats.decreases;
+        // let the latency baseline settle at the smaller window before judging it again
+        stats.smoothed_first_byte_seconds = stats.min_first_byte_seconds;
+    }
+    else if (epoch_saturated && window < ceiling)
+    {
+        window = std::min(static_cast<double>(ceiling), window + 1);
+        stats.last_decision = LimiterDecision::Increase;
+        ++stats.increases;
+    }
+    else
+    {
+        stats.last_decision = LimiterDecision::Hold;
+    }
+
+    stats.window = static_cast<size_t>(window);
+    stats.throughput_bytes_per_second = throughput;
+    last_throughput = epoch_saturated ? throughput : 0;
+    epoch_start = now;
+    epoch_completions = 0;
+    epoch_bytes = 0;
+    epoch_failed = false;
+    epoch_saturated = false;
+}
+
+}
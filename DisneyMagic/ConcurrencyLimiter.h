@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace curlhelpers
+{
+
+enum class LimiterDecision
+{
+    Hold,
+    Increase,
+    Decrease
+};
+
+struct LimiterStats
+{
+    size_t window { 0 };
+    uint64_t increases { 0 };
+    uint64_t decreases { 0 };
+    LimiterDecision last_decision { LimiterDecision::Hold };
+    double throughput_bytes_per_second { 0 };
+    double smoothed_first_byte_seconds { 0 };
+    double min_first_byte_seconds { 0 };
+};
+
+// Additive-increase/multiplicative-decrease governor for the number of
+// transfers in flight. Every window's worth of completions it grows the window
+// by one unless time-to-first-byte has inflated, the last increase cost
+// throughput or a transfer failed, in which case it shrinks the window by
+// decrease_factor. Throughput is only judged, and the window only grown, over
+// epochs in which the window was the limit; an idle app says nothing about
+// congestion.
+class ConcurrencyLimiter
+{
+public:
+    ConcurrencyLimiter(size_t floor, size_t ceiling, size_t initial, double decrease_factor = 0.7, double latency_tolerance = 2.0);
+
+    size_t Window() const;
+    // Reports that the window was full or requests were queued behind it.
+    void OnSaturated();
+    void OnComplete(double first_byte_seconds, uint64_t bytes, bool failed);
+
+    LimiterStats GetStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void Decide();
+
+    size_t floor;
+    size_t ceiling;
+    double decrease_factor;
+    double latency_tolerance;
+    mutable std::mutex mutex;
+    double window;
+    Clock::time_point epoch_start;
+    size_t epoch_completions;
+    uint64_t epoch_bytes;
+    bool epoch_failed;
+    bool epoch_saturated;
+    // zero unless the previous epoch was saturated
+    double last_throughput;
+    LimiterStats stats;
+};
+
+}
@@ -0,0 +1,184 @@
+#include "ConnectionPool.h"
+#include <stdexcept>
+
+namespace curlhelpers
+{
+
+ConnectionPool::ConnectionPool(size_t max_idle_per_host)
+    :   share(nullptr),
+        share_locks(),
+        max_idle_per_host(max_idle_per_host),
+        mutex(),
+        idle(),
+        checked_out(),
+        stats()
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    share = curl_share_init();
+    if (share == nullptr)
+    {
+        throw std::runtime_error("Curl share init failed");
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, &ConnectionPool::Lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, &ConnectionPool::Unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (auto& entry : idle)
+    {
+        for (CURL* handle : entry.second)
+        {
+            curl_easy_cleanup(handle);
+        }
+    }
+    for (auto& entry : checked_out)
+    {
+        curl_easy_cleanup(entry.first);
+    }
+    curl_share_cleanup(share);
+    curl_global_cleanup();
+}
+
+CURL* ConnectionPool::CheckOut(const std::string& url)
+{
+    std::string host = HostOf(url);
+    CURL* handle = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& handles = idle[host];
+        if (!handles.empty())
+        {
+            handle = handles.back();
+            handles.pop_back();
+            ++stats.handles_reused;
+        }
+    }
+
+    if (handle == nullptr)
+    {
+        handle = curl_easy_init();
+        if (handle == nullptr)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.handles_created;
+    }
+
+    ApplyDefaults(handle);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    checked_out[handle] = host;
+    return handle;
+}
+
+void ConnectionPool::CheckIn(CURL* handle)
+{
+    long response_code { 0 };
+    long connects { 0 };
+    curl_off_t app_connect_time { 0 };
+    long http_version { CURL_HTTP_VERSION_NONE };
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &http_version);
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &app_connect_time);
+
+    // reset drops per-request options but keeps the handle's caches alive
+    curl_easy_reset(handle);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (connects > 0)
+    {
+        stats.new_connections += connects;
+        if (app_connect_time > 0)
+        {
+            ++stats.tls_handshakes;
+        }
+    }
+    else if (response_code != 0)
+    {
+        ++stats.connections_reused;
+    }
+
+    if (http_version == CURL_HTTP_VERSION_2_0)
+    {
+        ++stats.http2_transfers;
+    }
+    else if (response_code != 0)
+    {
+        ++stats.http1_transfers;
+    }
+
+    auto found = checked_out.find(handle);
+    if (found == checked_out.end())
+    {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    auto& handles = idle[found->second];
+    checked_out.erase(found);
+    if (handles.size() < max_idle_per_host)
+    {
+        handles.push_back(handle);
+    }
+    else
+    {
+        curl_easy_cleanup(handle);
+    }
+}
+
+PoolStats ConnectionPool::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::string ConnectionPool::HostOf(const std::string& url)
+{
+    std::string host;
+    CURLU* parsed = curl_url();
+    if (parsed != nullptr)
+    {
+        char* part = nullptr;
+        if (curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+            curl_url_get(parsed, CURLUPART_HOST, &part, 0) == CURLUE_OK)
+        {
+            host = part;
+            curl_free(part);
+        }
+        curl_url_cleanup(parsed);
+    }
+    return host;
+}
+
+void ConnectionPool::Lock(CURL*, curl_lock_data data, curl_lock_access, void* user)
+{
+    static_cast<ConnectionPool*>(user)->share_locks[data].lock();
+}
+
+void ConnectionPool::Unlock(CURL*, curl_lock_data data, void* user)
+{
+    static_cast<ConnectionPool*>(user)->share_locks[data].unlock();
+}
+
+void ConnectionPool::ApplyDefaults(CURL* handle)
+{
+    curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    // negotiate h2 over TLS via ALPN, falling back to HTTP/1.1 when the server declines
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    // wait for an existing connection to confirm multiplexing rather than opening another
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 30L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 15L);
+    curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, 300L);
+    curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace curlhelpers
+{
+
+struct PoolStats
+{
+    uint64_t handles_created { 0 };
+    uint64_t handles_reused { 0 };
+    uint64_t connections_reused { 0 };
+    uint64_t new_connections { 0 };
+    uint64_t tls_handshakes { 0 };
+    uint64_t http2_transfers { 0 };
+    uint64_t http1_transfers { 0 };
+};
+
+// Keeps idle easy handles per host so transfers reuse them instead of creating
+// new ones, and shares DNS, connection and TLS session caches between all of them.
+class ConnectionPool
+{
+public:
+    explicit ConnectionPool(size_t max_idle_per_host = 16);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    CURL* CheckOut(const std::string& url);
+    void CheckIn(CURL* handle);
+
+    PoolStats GetStats() const;
+
+    static std::string HostOf(const std::string& url);
+
+private:
+    static void Lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* user);
+    static void Unlock(CURL* handle, curl_lock_data data, void* user);
+
+    void ApplyDefaults(CURL* handle);
+
+    CURLSH* share;
+    std::mutex share_locks[CURL_LOCK_DATA_LAST];
+    size_t max_idle_per_host;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::vector<CURL*>> idle;
+    std::unordered_map<CURL*, std::string> checked_out;
+    PoolStats stats;
+};
+
+}
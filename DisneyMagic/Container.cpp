@@ -2,79 +2,233 @@
 #include "CurlHelpers.h"
 #include <iostream>
 #include <exception>
+#include <algorithm>
+#include <chrono>
 
 namespace disneymagic
 {
 
+namespace
+{
+
+// Tiles further than this many rows or columns from the viewport are not fetched.
+const size_t kMaxPrefetchDistance { 3 };
+// Prefetched tiles only fetch this much of the image, enough for the first scans of a progressive JPEG.
+const uint64_t kPreviewBytes { 16 * 1024 };
+
+size_t distance_outside(size_t index, size_t first, size_t count)
+{
+    if (index < first)
+    {
+        return first - index;
+    }
+    if (index >= first + count)
+    {
+        return index - (first + count) + 1;
+    }
+    return 0;
+}
+
+bool fetch_priority_for_distance(size_t distance, curlhelpers::FetchPriority& priority)
+{
+    if (distance == 0)
+    {
+        priority = curlhelpers::FetchPriority::Visible;
+    }
+    else if (distance == 1)
+    {
+        priority = curlhelpers::FetchPriority::NearViewport;
+    }
+    else if (distance <= kMaxPrefetchDistance)
+    {
+        priority = curlhelpers::FetchPriority::Prefetch;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+}
+
 ContainerFactory::ContainerFactory(
+    SetResolver& set_resolver,
     sf::RenderWindow& window,
     const sf::Font& font,
     double desired_image_width,
     double desired_image_height)
-    :   window(window),
+    :   set_resolver(set_resolver),
+        window(window),
         font(font),
         desired_image_width(desired_image_width),
         desired_image_height(desired_image_height)
 {}
 
-std::unique_ptr<Container> ContainerFactory::operator()(const rapidjson::Value& collection_set)
+std::unique_ptr<Container> ContainerFactory::operator()(const CatalogContainer& container)
 {
-    return std::make_unique<Container>(collection_set, window, font, desired_image_width, desired_image_height);
+    return std::make_unique<Container>(container, set_resolver, window, font, desired_image_width, desired_image_height);
 }
 
 ContainerItem::ContainerItem(
-    const rapidjson::Value& item,
+    const CatalogItem& item,
     sf::RenderWindow& window,
     const sf::Font& font,
     double desired_image_width,
     double desired_image_height)
-    :   image(),
+    :   pending_image(),
+        progressive_image(),
+        image_request(0),
+        image_fetch_needed(true),
+        fetch_wanted(false),
+        fetch_priority(curlhelpers::FetchPriority::Prefetch),
+        partial_image(),
+        has_full_image(false),
+        image_url(item.image_url),
+        desired_image_width(desired_image_width),
+        desired_image_height(desired_image_height),
+        image(),
         sprite(),
         text(),
         window(window),
         has_image(false),
+        has_failed(false),
         default_scale()
 {
-    auto& item_type = item["type"];
-    std::string title_type_string;
-    std::string image_type_string;
-    if (strcmp(item_type.GetString(), "DmcSeries") == 0)
+    text.setFillColor(sf::Color::White);
+    text.setString(std::string(item.title));
+    text.setFont(font);
+    text.setCharacterSize(24);
+}
+
+void ContainerItem::SetFetchPriority(curlhelpers::FetchPriority priority)
+{
+    fetch_priority = priority;
+    fetch_wanted = true;
+    // a finished fetch, or one cancelled when the tile went out of range, is
+    // consumed first so that a cancelled one is submitted again below
+    if (pending_image.valid() &&
+        (image_fetch_needed || pending_image.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
     {
-        title_type_string = "series";
-        image_type_string = "series";
+        ResolvePendingImage();
     }
-    else if (strcmp(item_type.GetString(), "DmcVideo") == 0)
+
+    if (pending_image.valid())
     {
-        title_type_string = "program";
-        image_type_string = "program";
+        curlhelpers::FetchEngine::Instance().Reprioritize(image_request, priority);
     }
-    else if (strcmp(item_type.GetString(), "StandardCollection") == 0)
+    else if (image_fetch_needed && !has_full_image)
     {
-        title_type_string = "collection";
-        image_type_string = "default";
+        // a tile that already has its preview waits for the viewport before fetching the rest
+        if (priority == curlhelpers::FetchPriority::Prefetch && !partial_image.empty())
+        {
+            return;
+        }
+        SubmitImageFetch(priority);
     }
+}
 
-    std::string title = item["text"]["title"]["full"][title_type_string.c_str()]["default"]["content"].GetString();
-    std::string image_url = item["image"]["tile"]["1.78"][image_type_string.c_str()]["default"]["url"].GetString();
+void ContainerItem::SubmitImageFetch(curlhelpers::FetchPriority priority)
+{
+    curlhelpers::FetchRange range;
+    if (!partial_image.empty())
+    {
+        // kept until the rest arrives, so a cancelled resume does not lose it
+        range.resume_from = partial_image;
+    }
+    else if (priority == curlhelpers::FetchPriority::Prefetch)
+    {
+        range.max_bytes = kPreviewBytes;
+    }
 
-    text.setFillColor(sf::Color::White);
-    text.setString(title);
-    text.setFont(font);
-    text.setCharacterSize(24);
+    image_fetch_needed = false;
+    progressive_image = std::make_shared<ProgressiveImage>();
+    std::shared_ptr<ProgressiveImage> preview = progressive_image;
+    pending_image = curlhelpers::FetchEngine::Instance().Submit(image_url, curlhelpers::RequestKind::TileImage, priority, &image_request,
+        [preview](const std::string& received) { preview->Append(received); }, std::move(range));
+}
 
-    std::string image_buffer;
-    try
+void ContainerItem::CancelFetch()
+{
+    fetch_priority = curlhelpers::FetchPriority::Prefetch;
+    fetch_wanted = false;
+    if (pending_image.valid())
     {
-        curlhelpers::retrieve_file_from_URL(image_url.c_str(), image_buffer);
+        curlhelpers::FetchEngine::Instance().Cancel(image_request);
+        image_fetch_needed = true;
     }
-    catch (std::runtime_error& e)
+}
+
+void ContainerItem::Update()
+{
+    if (pending_image.valid() && pending_image.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
     {
-        std::cout << e.what() << std::endl;
+        ResolvePendingImage();
+    }
+}
+
+void ContainerItem::ResolvePendingImage()
+{
+    if (!pending_image.valid())
+    {
+        return;
+    }
+    if (pending_image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        std::string preview;
+        if (progressive_image->TakePreview(preview))
+        {
+            ShowImage(preview);
+        }
+        return;
+    }
+
+    curlhelpers::FetchResult result = pending_image.get();
+    std::shared_ptr<ProgressiveImage> preview = std::move(progressive_image);
+    if (result.cancelled)
+    {
+        // the tile came back into range after the cancel was sent
+        image_fetch_needed = true;
+        if (fetch_wanted)
+        {
+            SetFetchPriority(fetch_priority);
+        }
+        return;
+    }
+    if (!result.Succeeded())
+    {
+        std::cout << result.error << std::endl;
         std::cout << "Failed to retrieve image file at URL" + image_url << std::endl;
+        has_failed = true;
         return;
     }
 
-    if (image.loadFromMemory(image_buffer.data(), image_buffer.size()))
+    if (result.IsPartial())
+    {
+        // show what the first scans give and fetch the rest once the tile is wanted
+        std::string preview_image;
+        if (preview->TakePreview(preview_image))
+        {
+            ShowImage(preview_image);
+        }
+        partial_image = std::move(result.body);
+        image_fetch_needed = true;
+        if (fetch_priority != curlhelpers::FetchPriority::Prefetch)
+        {
+            SubmitImageFetch(fetch_priority);
+        }
+        return;
+    }
+
+    ShowImage(result.body);
+    has_full_image = true;
+    partial_image.clear();
+    curlhelpers::FetchEngine::Instance().Recycle(std::move(result.body));
+}
+
+void ContainerItem::ShowImage(const std::string& encoded_image)
+{
+    if (image.loadFromMemory(encoded_image.data(), encoded_image.size()))
     {
         default_scale.x = desired_image_width / image.getSize().x;
         default_scale.y = desired_image_height / image.getSize().y;
@@ -95,8 +249,20 @@ void ContainerItem::ResetScale()
     sprite.setScale(default_scale);
 }
 
+bool ContainerItem::HasImage() const
+{
+    return has_image;
+}
+
+bool ContainerItem::HasFailed() const
+{
+    return has_failed;
+}
+
 void ContainerItem::Draw(const sf::Vector2f& position)
 {
+    ResolvePendingImage();
+
     if (has_image)
     {
         sprite.setPosition(position);
@@ -110,32 +276,52 @@ void ContainerItem::Draw(const sf::Vector2f& position)
 }
 
 Container::Container(
-    const rapidjson::Value& container,
+    const CatalogContainer& container,
+    SetResolver& set_resolver,
     sf::RenderWindow& window,
     const sf::Font& font,
     double desired_image_width,
     double desired_image_height)
-    :   title(container["set"]["text"]["title"]["full"]["set"]["default"]["content"].GetString())
+    :   window(window),
+        font(font),
+        desired_image_width(desired_image_width),
+        desired_image_height(desired_image_height),
+        title(container.title),
+        pending_set(),
+        set_request(0),
+        first_visible_item(0),
+        visible_item_count(0),
+        row_distance(0),
+        items()
 {
-    try
+    if (container.ref_id.empty())
     {
-        if (std::strcmp(container["set"]["type"].GetString(), "SetRef") != 0)
-        {
-            PopulateItems(container["set"], window, font, desired_image_width, desired_image_height);
-        }
-        else
-        {
-            std::string container_ref_id = container["set"]["refId"].GetString();
-            std::string container_url = "https://cd-static.bamgrid.com/dp-117731241344/sets/" + container_ref_id + ".json";
-            std::string container_api_contents;
+        PopulateItems(container.items);
+    }
+    else
+    {
+        pending_set = set_resolver.Take(std::string(container.ref_id), set_request);
+    }
+}
 
-            curlhelpers::retrieve_file_from_URL(container_url, container_api_contents);
+void Container::Update()
+{
+    for (ContainerItem& item : items)
+    {
+        item.Update();
+    }
 
-            rapidjson::Document api_doc;
-            api_doc.Parse(container_api_contents.c_str());
+    if (!pending_set.valid() || pending_set.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return;
+    }
 
-            PopulateItems(api_doc["data"].MemberBegin()->value, window, font, desired_image_width, desired_image_height);
-        }
+    try
+    {
+        // extracted on the parse pool; a failed fetch or a malformed document throws here
+        Catalog set = pending_set.get();
+        PopulateItems(set.Containers().front().items);
+        curlhelpers::FetchEngine::Instance().Recycle(set.Release());
     }
     catch(std::exception& e)
     {
@@ -147,6 +333,28 @@ Container::Container(
     }
 }
 
+bool Container::IsPopulated() const
+{
+    return !pending_set.valid();
+}
+
+void Container::UpdateFetchPriorities(size_t first_visible_item, size_t visible_item_count, size_t row_distance)
+{
+    this->first_visible_item = first_visible_item;
+    this->visible_item_count = visible_item_count;
+    this->row_distance = row_distance;
+
+    if (pending_set.valid())
+    {
+        // set documents are small and gate every tile in the row, so they are never dropped
+        curlhelpers::FetchPriority priority = curlhelpers::FetchPriority::Prefetch;
+        fetch_priority_for_distance(row_distance, priority);
+        curlhelpers::FetchEngine::Instance().Reprioritize(set_request, priority);
+    }
+
+    ApplyFetchPriorities();
+}
+
 std::string Container::GetTitle() const
 {
     return title;
@@ -162,14 +370,36 @@ ContainerItem& Container::GetItem(size_t index)
     return items.at(index);
 }
 
-void Container::PopulateItems(const rapidjson::Value& foo, sf::RenderWindow& window, const sf::Font& font, double desired_image_width, double desired_image_height)
+void Container::PopulateItems(const std::vector<CatalogItem>& catalog_items)
 {
-    const auto& items_array = foo["items"].GetArray();
-    items.reserve(items_array.Size());
-    for (const auto& item : items_array)
+    items.reserve(catalog_items.size());
+    for (const auto& item : catalog_items)
     {
         items.emplace_back(item, window, font, desired_image_width, desired_image_height);
     }
+
+    // rows populated before the first viewport update wait for it to start fetching
+    if (visible_item_count > 0)
+    {
+        ApplyFetchPriorities();
+    }
+}
+
+void Container::ApplyFetchPriorities()
+{
+    for (size_t index = 0; index < items.size(); ++index)
+    {
+        size_t column_distance = distance_outside(index, first_visible_item, visible_item_count);
+        curlhelpers::FetchPriority priority;
+        if (fetch_priority_for_distance(std::max(row_distance, column_distance), priority))
+        {
+            items[index].SetFetchPriority(priority);
+        }
+        else
+        {
+            items[index].CancelFetch();
+        }
+    }
 }
 
 }
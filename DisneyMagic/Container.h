@@ -1,11 +1,14 @@
 #pragma once
 
+#include "CatalogExtractor.h"
 #include "CurlHelpers.h"
+#include "ProgressiveImage.h"
+#include "SetResolver.h"
 #include <SFML/Graphics.hpp>
 #include <string>
 #include <vector>
 #include <memory>
-#include <rapidjson/document.h>
+#include <future>
 
 namespace disneymagic
 {
@@ -15,22 +18,55 @@ class ContainerItem
 {
 public:
     ContainerItem(
-        const rapidjson::Value& item,
+        const CatalogItem& item,
         sf::RenderWindow& window,
         const sf::Font& font,
         double desired_image_width,
         double desired_image_height);
 
+    // Submits the image fetch on first use, reprioritizes it while queued and
+    // resubmits it if it was cancelled earlier. A prefetch only downloads the
+    // start of the image for a coarse preview; the rest follows once the tile
+    // comes closer to the viewport.
+    void SetFetchPriority(curlhelpers::FetchPriority priority);
+    void CancelFetch();
+    // Picks up a fetch that has finished, so the rest of a ranged prefetch
+    // starts once the tile is wanted rather than once it is drawn.
+    void Update();
+
     void EnhanceScale(const sf::Vector2f& factors);
     void ResetScale();
     void Draw(const sf::Vector2f& position);
 
+    // True once a preview or the full image is showing.
+    bool HasImage() const;
+    // True once the image fetch has failed; the tile keeps showing its title.
+    bool HasFailed() const;
+
 private:
+    void SubmitImageFetch(curlhelpers::FetchPriority priority);
+    void ResolvePendingImage();
+    void ShowImage(const std::string& encoded_image);
+
+    std::future<curlhelpers::FetchResult> pending_image;
+    std::shared_ptr<ProgressiveImage> progressive_image;
+    curlhelpers::RequestId image_request;
+    bool image_fetch_needed;
+    // false while the tile is too far from the viewport to fetch
+    bool fetch_wanted;
+    curlhelpers::FetchPriority fetch_priority;
+    // the start of the image fetched for a preview, until the rest is fetched
+    std::string partial_image;
+    bool has_full_image;
+    std::string image_url;
+    double desired_image_width;
+    double desired_image_height;
     sf::Texture image;
     sf::Sprite sprite;
     sf::Text text;
     sf::RenderWindow& window;
     bool has_image;
+    bool has_failed;
     sf::Vector2f default_scale;
 };
 
@@ -38,20 +74,40 @@ class Container
 {
 public:
     Container(
-        const rapidjson::Value& container,
+        const CatalogContainer& container,
+        SetResolver& set_resolver,
         sf::RenderWindow& window,
         const sf::Font& font,
         double desired_image_width,
         double desired_image_height);
 
+    // Populates the items of a SetRef container once its set document has
+    // arrived and been extracted, and picks up finished tile fetches.
+    void Update();
+    // False while the set document of a SetRef container is still outstanding.
+    bool IsPopulated() const;
+
+    // Ranks tile fetches by distance from the viewport and drops those too far away to matter.
+    void UpdateFetchPriorities(size_t first_visible_item, size_t visible_item_count, size_t row_distance);
+
     std::string GetTitle() const;
     size_t GetItemCount() const;
     ContainerItem& GetItem(size_t index);
 
 private:
-    void PopulateItems(const rapidjson::Value& foo, sf::RenderWindow& window, const sf::Font& font, double desired_image_width, double desired_image_height);
+    void PopulateItems(const std::vector<CatalogItem>& catalog_items);
+    void ApplyFetchPriorities();
 
+    sf::RenderWindow& window;
+    const sf::Font& font;
+    double desired_image_width;
+    double desired_image_height;
     std::string title;
+    std::future<Catalog> pending_set;
+    curlhelpers::RequestId set_request;
+    size_t first_visible_item;
+    size_t visible_item_count;
+    size_t row_distance;
     std::vector<ContainerItem> items;
 };
 
@@ -59,14 +115,16 @@ class ContainerFactory
 {
 public:
     ContainerFactory(
+        SetResolver& set_resolver,
         sf::RenderWindow& window,
         const sf::Font& font,
         double desired_image_width,
         double desired_image_height);
 
-    std::unique_ptr<Container> operator()(const rapidjson::Value& collection_set);
+    std::unique_ptr<Container> operator()(const CatalogContainer& container);
 
 private:
+    SetResolver& set_resolver;
     sf::RenderWindow& window;
     const sf::Font& font;
     double desired_image_width;
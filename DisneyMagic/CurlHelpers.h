@@ -1,10 +1,12 @@
 #pragma once
 
+#include "FetchEngine.h"
 #include <curl/curl.h>
 #include <string>
 #include <exception>
 
 namespace curlhelpers
 {
-    void retrieve_file_from_URL(const std::string& url, std::string& fileBuffer);
+    // Blocking convenience wrapper that submits to FetchEngine::Instance() and waits.
+    void retrieve_file_from_URL(const std::string& url, std::string& fileBuffer, RequestKind kind = RequestKind::Other);
 }
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include "CurlTransport.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+TransferTiming read_timing(CURL* handle)
+{
+    curl_off_t name_lookup { 0 };
+    curl_off_t connect { 0 };
+    curl_off_t app_connect { 0 };
+    curl_off_t first_byte { 0 };
+    curl_off_t total { 0 };
+    curl_off_t downloaded { 0 };
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &name_lookup);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &app_connect);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+
+    // curl reports each time from the start of the transfer, and reused connections skip phases
+    auto phase = [](curl_off_t end, curl_off_t begin) { return static_cast<uint64_t>(end > begin ? end - begin : 0); };
+    curl_off_t connected = std::max({ name_lookup, connect, app_connect });
+    TransferTiming timing;
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::NameLookup)] = phase(name_lookup, 0);
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::Connect)] = phase(connect, name_lookup);
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::TlsHandshake)] = phase(app_connect, std::max(connect, name_lookup));
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::FirstByte)] = phase(first_byte, connected);
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::Download)] = first_byte > 0 ? phase(total, std::max(first_byte, connected)) : 0;
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::Total)] = phase(total, 0);
+    timing.bytes = static_cast<uint64_t>(downloaded);
+    return timing;
+}
+
+bool host_and_port(const std::string& url, std::string& host, long& port)
+{
+    CURLU* parsed = curl_url();
+    if (parsed == nullptr)
+    {
+        return false;
+    }
+    char* host_part = nullptr;
+    char* port_part = nullptr;
+    bool found = curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+        curl_url_get(parsed, CURLUPART_HOST, &host_part, 0) == CURLUE_OK &&
+        curl_url_get(parsed, CURLUPART_PORT, &port_part, CURLU_DEFAULT_PORT) == CURLUE_OK;
+    if (found)
+    {
+        host = host_part;
+        port = std::strtol(port_part, nullptr, 10);
+    }
+    curl_free(host_part);
+    curl_free(port_part);
+    curl_url_cleanup(parsed);
+    return found;
+}
+
+// Content-Length only gives the decoded size when no content encoding was applied.
+size_t expected_body_size(const FetchResult& result)
+{
+    const std::string* length = result.Header("content-length");
+    if (length == nullptr || result.Header("content-encoding") != nullptr)
+    {
+        return 0;
+    }
+    return static_cast<size_t>(std::strtoull(length->c_str(), nullptr, 10));
+}
+
+}
+
+CurlTransport::CurlTransport(
+    size_t max_streams_per_host,
+    long max_connections_per_host,
+    long connect_timeout_ms,
+    long total_timeout_ms,
+    std::unique_ptr<ResolverState> resolver_state)
+    :   pool(),
+        multi(nullptr),
+        connect_timeout_ms(connect_timeout_ms),
+        total_timeout_ms(total_timeout_ms),
+        active(),
+        preconnecting(),
+        resolver_state(std::move(resolver_state))
+{
+    multi = curl_multi_init();
+    if (multi == nullptr)
+    {
+        throw std::runtime_error("Curl multi init failed");
+    }
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_connections_per_host);
+    curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, static_cast<long>(max_streams_per_host));
+}
+
+CurlTransport::~CurlTransport()
+{
+    while (!active.empty())
+    {
+        Release(*active.begin()->first);
+    }
+    while (!preconnecting.empty())
+    {
+        ReleasePreconnect(preconnecting.begin()->first);
+    }
+    curl_multi_cleanup(multi);
+}
+
+bool CurlTransport::Start(TransportRequest& request)
+{
+    CURL* handle = pool.CheckOut(request.result.url);
+    if (handle == nullptr)
+    {
+        return false;
+    }
+
+    curl_slist* headers = nullptr;
+    for (const std::string& header : request.request_headers)
+    {
+        headers = curl_slist_append(headers, header.c_str());
+    }
+
+    curl_easy_setopt(handle, CURLOPT_URL, request.result.url.c_str());
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, &request);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &CurlTransport::ReceiveBody);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &request);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, &CurlTransport::ReceiveHeader);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &request.result);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, total_timeout_ms);
+    if (request.accept_encoding)
+    {
+        // an empty string offers every encoding this libcurl can decode (gzip, deflate, br)
+        curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+    }
+    if (headers != nullptr)
+    {
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    }
+    curl_slist* resolve = ApplyResolverState(handle, request.result.url);
+
+    curl_multi_add_handle(multi, handle);
+    active[&request] = ActiveRequest { handle, headers, resolve };
+    return true;
+}
+
+void CurlTransport::Abort(TransportRequest& request)
+{
+    Release(request);
+}
+
+void CurlTransport::Perform(std::vector<TransportRequest*>& completed)
+{
+    int running_count { 0 };
+    curl_multi_perform(multi, &running_count);
+
+    int queued_count { 0 };
+    while (CURLMsg* message = curl_multi_info_read(multi, &queued_count))
+    {
+        if (message->msg != CURLMSG_DONE)
+        {
+            continue;
+        }
+
+        UpdateResolverState(message->easy_handle, message->data.result);
+
+        char* request_data = nullptr;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &request_data);
+        if (request_data == nullptr)
+        {
+            // the connection stays in the shared cache for the requests that follow
+            ReleasePreconnect(message->easy_handle);
+            continue;
+        }
+        TransportRequest* request = reinterpret_cast<TransportRequest*>(request_data);
+        request->result.curl_code = message->data.result;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_RESPONSE_CODE, &request->result.status_code);
+        request->timing = read_timing(message->easy_handle);
+        request->timing.decoded_bytes = request->result.body.size();
+        Release(*request);
+        completed.push_back(request);
+    }
+}
+
+void CurlTransport::Wait(long timeout_ms)
+{
+    curl_multi_poll(multi, nullptr, 0, static_cast<int>(timeout_ms), nullptr);
+}
+
+void CurlTransport::Wakeup()
+{
+    curl_multi_wakeup(multi);
+}
+
+void CurlTransport::Preconnect(const std::string& url)
+{
+    CURL* handle = pool.CheckOut(url);
+    if (handle == nullptr)
+    {
+        return;
+    }
+
+    // a HEAD request leaves a connection that later transfers can reuse, which CURLOPT_CONNECT_ONLY does not
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, total_timeout_ms);
+    curl_slist* resolve = ApplyResolverState(handle, url);
+    curl_multi_add_handle(multi, handle);
+    preconnecting[handle] = resolve;
+}
+
+PoolStats CurlTransport::GetPoolStats() const
+{
+    return pool.GetStats();
+}
+
+size_t CurlTransport::ReceiveBody(char* data, size_t member_size, size_t member_count, TransportRequest* request)
+{
+    size_t size = member_size * member_count;
+    if (request->result.body.empty())
+    {
+        // every header has arrived by the time the body starts
+        request->ReserveBody(expected_body_size(request->result));
+    }
+    request->result.body.append(data, size);
+    request->BodyReceived();
+    return size;
+}
+
+size_t CurlTransport::ReceiveHeader(char* data, size_t member_size, size_t member_count, FetchResult* result)
+{
+    size_t size = member_size * member_count;
+    std::string line(data, size);
+    if (line.compare(0, 5, "HTTP/") == 0)
+    {
+        // a new status line starts a new header block (redirects, 100 Continue)
+        result->headers.clear();
+        return size;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+    {
+        return size;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+    size_t value_begin = line.find_first_not_of(" \t", colon + 1);
+    size_t value_end = line.find_last_not_of(" \t\r\n");
+    std::string value = (value_begin == std::string::npos || value_end < value_begin)
+        ? std::string()
+        : line.substr(value_begin, value_end - value_begin + 1);
+    result->headers.emplace_back(std::move(name), std::move(value));
+    return size;
+}
+
+void CurlTransport::Release(TransportRequest& request)
+{
+    auto found = active.find(&request);
+    if (found == active.end())
+    {
+        return;
+    }
+    curl_multi_remove_handle(multi, found->second.handle);
+    pool.CheckIn(found->second.handle);
+    curl_slist_free_all(found->second.headers);
+    curl_slist_free_all(found->second.resolve);
+    active.erase(found);
+}
+
+void CurlTransport::ReleasePreconnect(CURL* handle)
+{
+    curl_multi_remove_handle(multi, handle);
+    pool.CheckIn(handle);
+    curl_slist_free_all(preconnecting[handle]);
+    preconnecting.erase(handle);
+}
+
+curl_slist* CurlTransport::ApplyResolverState(CURL* handle, const std::string& url)
+{
+    std::string host;
+    long port { 0 };
+    if (!resolver_state || !host_and_port(url, host, port))
+    {
+        return nullptr;
+    }
+    curl_slist* resolve = resolver_state->AppendResolveEntry(host, port, nullptr);
+    if (resolve != nullptr)
+    {
+        curl_easy_setopt(handle, CURLOPT_RESOLVE, resolve);
+    }
+    return resolve;
+}
+
+void CurlTransport::UpdateResolverState(CURL* handle, CURLcode code)
+{
+    char* url = nullptr;
+    std::string host;
+    long port { 0 };
+    if (!resolver_state ||
+        curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == nullptr ||
+        !host_and_port(url, host, port))
+    {
+        return;
+    }
+
+    if (code == CURLE_COULDNT_CONNECT)
+    {
+        resolver_state->Forget(host, port);
+        return;
+    }
+    char* address = nullptr;
+    if (code == CURLE_OK && curl_easy_getinfo(handle, CURLINFO_PRIMARY_IP, &address) == CURLE_OK && address != nullptr)
+    {
+        resolver_state->Record(host, port, address);
+    }
+}
+
+}
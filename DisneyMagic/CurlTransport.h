@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ConnectionPool.h"
+#include "ResolverState.h"
+#include "Transport.h"
+#include <curl/curl.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace curlhelpers
+{
+
+// Runs requests over the network with curl_multi, drawing easy handles from a
+// connection pool that shares DNS, connection and TLS session caches. With a
+// resolver state, resolved addresses also carry over to the next launch.
+class CurlTransport : public Transport
+{
+public:
+    CurlTransport(
+        size_t max_streams_per_host,
+        long max_connections_per_host,
+        long connect_timeout_ms,
+        long total_timeout_ms,
+        std::unique_ptr<ResolverState> resolver_state = nullptr);
+    ~CurlTransport() override;
+
+    CurlTransport(const CurlTransport&) = delete;
+    CurlTransport& operator=(const CurlTransport&) = delete;
+
+    bool Start(TransportRequest& request) override;
+    void Abort(TransportRequest& request) override;
+    void Perform(std::vector<TransportRequest*>& completed) override;
+    void Wait(long timeout_ms) override;
+    void Wakeup() override;
+    void Preconnect(const std::string& url) override;
+
+    PoolStats GetPoolStats() const override;
+
+private:
+    struct ActiveRequest
+    {
+        CURL* handle;
+        curl_slist* headers;
+        curl_slist* resolve;
+    };
+
+    static size_t ReceiveBody(char* data, size_t member_size, size_t member_count, TransportRequest* request);
+    static size_t ReceiveHeader(char* data, size_t member_size, size_t member_count, FetchResult* result);
+
+    void Release(TransportRequest& request);
+    void ReleasePreconnect(CURL* handle);
+    curl_slist* ApplyResolverState(CURL* handle, const std::string& url);
+    void UpdateResolverState(CURL* handle, CURLcode code);
+
+    ConnectionPool pool;
+    CURLM* multi;
+    long connect_timeout_ms;
+    long total_timeout_ms;
+    std::unordered_map<TransportRequest*, ActiveRequest> active;
+    // handles opening connections for Preconnect, with their resolve entries; they carry no request
+    std::unordered_map<CURL*, curl_slist*> preconnecting;
+    std::unique_ptr<ResolverState> resolver_state;
+};
+
+}
@@ -0,0 +1,316 @@
+#include "DiskCache.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <sys/stat.h>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+const char* kIndexFileName = "index.tsv";
+// A change to nothing but the access order waits this long to be saved.
+const std::time_t kOrderSaveIntervalSeconds { 60 };
+
+uint64_t fnv1a(const std::string& value)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : value)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void make_directories(const std::string& path)
+{
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+    {
+        std::string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return;
+        }
+        if (slash == std::string::npos)
+        {
+            return;
+        }
+    }
+}
+
+}
+
+bool CacheEntry::IsFresh(std::time_t now) const
+{
+    return now < stored_at + max_age;
+}
+
+DiskCache::DiskCache(const std::string& directory, uint64_t max_bytes)
+    :   directory(directory),
+        max_bytes(max_bytes),
+        total_bytes(0),
+        access_clock(0),
+        dirty(false),
+        order_changed(false),
+        saved_at(std::time(nullptr)),
+        mutex(),
+        entries(),
+        stats()
+{
+    make_directories(directory);
+    LoadIndex();
+}
+
+DiskCache::~DiskCache()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (dirty || order_changed)
+    {
+        SaveIndex(lock);
+    }
+}
+
+bool DiskCache::Contains(const std::string& url, uint64_t& body_size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(url);
+    if (found == entries.end())
+    {
+        ++stats.misses;
+        return false;
+    }
+    body_size = found->second.size;
+    return true;
+}
+
+bool DiskCache::Lookup(const std::string& url, CacheEntry& entry, std::string& body)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto found = entries.find(url);
+    if (found == entries.end())
+    {
+        ++stats.misses;
+        return false;
+    }
+    uint64_t size = found->second.size;
+    lock.unlock();
+
+    // the index knows the size, so the body is read in one go into whatever capacity the caller has
+    std::ifstream file(BodyPath(url), std::ios::binary);
+    body.resize(size);
+    bool read = file && file.read(&body[0], body.size());
+
+    lock.lock();
+    found = entries.find(url);
+    if (!read || found == entries.end() || found->second.size != size)
+    {
+        body.clear();
+        if (!read && found != entries.end() && found->second.size == size)
+        {
+            total_bytes -= found->second.size;
+            entries.erase(found);
+            dirty = true;
+        }
+        ++stats.misses;
+        return false;
+    }
+
+    found->second.last_access = ++access_clock;
+    order_changed = true;
+    entry = found->second;
+    if (entry.IsFresh(std::time(nullptr)))
+    {
+        ++stats.fresh_hits;
+    }
+    else
+    {
+        ++stats.stale_hits;
+    }
+    return true;
+}
+
+// Stores are expected from one thread at a time, since the body goes through a temporary file named after the URL.
+void DiskCache::Store(const std::string& url, CacheEntry entry, const std::string& body)
+{
+    std::string path = BodyPath(url);
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.write(body.data(), body.size()))
+        {
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(url);
+    if (found != entries.end())
+    {
+        total_bytes -= found->second.size;
+        ++stats.replaced;
+    }
+
+    entry.size = body.size();
+    entry.last_access = ++access_clock;
+    entries[url] = entry;
+    total_bytes += entry.size;
+    dirty = true;
+
+    EvictToFit();
+}
+
+void DiskCache::Refresh(const std::string& url, std::time_t max_age)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(url);
+    if (found != entries.end())
+    {
+        found->second.stored_at = std::time(nullptr);
+        found->second.max_age = max_age;
+        dirty = true;
+        ++stats.revalidated;
+    }
+}
+
+void DiskCache::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (dirty || (order_changed && std::time(nullptr) - saved_at >= kOrderSaveIntervalSeconds))
+    {
+        SaveIndex(lock);
+    }
+}
+
+CacheStats DiskCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::string DiskCache::DefaultDirectory()
+{
+    const char* home = std::getenv("HOME");
+    if (home != nullptr && *home != '\0')
+    {
+        return std::string(home) + "/Library/Caches/RCEnterprises.DisneyMagic/http";
+    }
+    const char* temp = std::getenv("TMPDIR");
+    return std::string(temp != nullptr ? temp : "/tmp") + "/DisneyMagic/http";
+}
+
+std::string DiskCache::BodyPath(const std::string& url) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.body", static_cast<unsigned long long>(fnv1a(url)));
+    return directory + "/" + name;
+}
+
+// Index lines are: url, etag, last-modified, stored-at, max-age, size, last-access (tab separated)
+void DiskCache::LoadIndex()
+{
+    std::ifstream file(directory + "/" + kIndexFileName);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t'))
+        {
+            fields.push_back(field);
+        }
+        if (fields.size() != 7)
+        {
+            continue;
+        }
+
+        CacheEntry entry;
+        entry.etag = fields[1];
+        entry.last_modified = fields[2];
+        entry.stored_at = std::strtoll(fields[3].c_str(), nullptr, 10);
+        entry.max_age = std::strtoll(fields[4].c_str(), nullptr, 10);
+        entry.size = std::strtoull(fields[5].c_str(), nullptr, 10);
+        entry.last_access = std::strtoull(fields[6].c_str(), nullptr, 10);
+
+        access_clock = std::max(access_clock, entry.last_access);
+        total_bytes += entry.size;
+        entries[fields[0]] = entry;
+    }
+    EvictToFit();
+}
+
+// Formats the index under the lock and writes it without holding it.
+void DiskCache::SaveIndex(std::unique_lock<std::mutex>& lock)
+{
+    std::ostringstream index;
+    for (const auto& entry : entries)
+    {
+        index << entry.first << '\t'
+              << entry.second.etag << '\t'
+              << entry.second.last_modified << '\t'
+              << entry.second.stored_at << '\t'
+              << entry.second.max_age << '\t'
+              << entry.second.size << '\t'
+              << entry.second.last_access << '\n';
+    }
+    // changes made while the file is written are saved the next time
+    dirty = false;
+    order_changed = false;
+    saved_at = std::time(nullptr);
+    lock.unlock();
+
+    std::string path = directory + "/" + kIndexFileName;
+    std::string temp_path = path + ".tmp";
+    bool saved = false;
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        file << index.str();
+        saved = static_cast<bool>(file);
+    }
+    if (!saved || std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        saved = false;
+    }
+
+    lock.lock();
+    if (!saved)
+    {
+        dirty = true;
+    }
+}
+
+void DiskCache::EvictToFit()
+{
+    while (total_bytes > max_bytes && !entries.empty())
+    {
+        auto oldest = entries.begin();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+        {
+            if (it->second.last_access < oldest->second.last_access)
+            {
+                oldest = it;
+            }
+        }
+        std::remove(BodyPath(oldest->first).c_str());
+        total_bytes -= oldest->second.size;
+        entries.erase(oldest);
+        ++stats.evictions;
+        dirty = true;
+    }
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace curlhelpers
+{
+
+struct CacheEntry
+{
+    std::string etag;
+    std::string last_modified;
+    std::time_t stored_at { 0 };
+    std::time_t max_age { 0 };
+    uint64_t size { 0 };
+    uint64_t last_access { 0 };
+
+    bool IsFresh(std::time_t now) const;
+};
+
+struct CacheStats
+{
+    uint64_t fresh_hits { 0 };
+    uint64_t stale_hits { 0 };
+    uint64_t misses { 0 };
+    uint64_t revalidated { 0 };
+    uint64_t replaced { 0 };
+    uint64_t evictions { 0 };
+};
+
+// Persistent HTTP response cache. Bodies live in one file per URL and the
+// validators in an index file; the total size is bounded with LRU eviction.
+// Safe to use from any thread. Files are read and written outside the lock,
+// so Contains and Refresh, which only touch the index in memory, never wait
+// on the disk.
+class DiskCache
+{
+public:
+    DiskCache(const std::string& directory, uint64_t max_bytes);
+    ~DiskCache();
+
+    DiskCache(const DiskCache&) = delete;
+    DiskCache& operator=(const DiskCache&) = delete;
+
+    // Counts a miss when the URL is not cached, so a Lookup need not follow.
+    // Otherwise body_size is the size the body had when it was indexed.
+    bool Contains(const std::string& url, uint64_t& body_size);
+    bool Lookup(const std::string& url, CacheEntry& entry, std::string& body);
+    void Store(const std::string& url, CacheEntry entry, const std::string& body);
+    void Refresh(const std::string& url, std::time_t max_age);
+    // Saves the index if entries changed. Hits only reorder the LRU list,
+    // which is saved at most every so often and when the cache is destroyed.
+    void Flush();
+
+    CacheStats GetStats() const;
+
+    static std::string DefaultDirectory();
+
+private:
+    std::string BodyPath(const std::string& url) const;
+    void LoadIndex();
+    void SaveIndex(std::unique_lock<std::mutex>& lock);
+    void EvictToFit();
+
+    std::string directory;
+    uint64_t max_bytes;
+    uint64_t total_bytes;
+    uint64_t access_clock;
+    bool dirty;
+    // hits since the last save, which only changed the access order
+    bool order_changed;
+    std::time_t saved_at;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, CacheEntry> entries;
+    CacheStats stats;
+};
+
+}
@@ -0,0 +1,276 @@
+#include "EmulatedTransport.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+// Bandwidth left unused while the link is idle is not saved up beyond this many seconds' worth.
+const double kMaxLinkBurstSeconds { 0.05 };
+// How often bodies are metered out while a bandwidth limit applies.
+const long kDeliveryIntervalMs { 5 };
+
+long milliseconds_until(std::chrono::steady_clock::time_point when, std::chrono::steady_clock::time_point now)
+{
+    return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(when - now).count());
+}
+
+uint64_t microseconds_between(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    return elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0;
+}
+
+}
+
+bool NetworkConditions::Parse(const std::string& spec, NetworkConditions& conditions)
+{
+    conditions = NetworkConditions();
+    if (spec == "3g")
+    {
+        conditions.round_trip_ms = 300;
+        conditions.jitter_ms = 100;
+        conditions.bandwidth_bytes_per_second = 200 * 1000;
+        return true;
+    }
+    if (spec == "lossy")
+    {
+        conditions.round_trip_ms = 100;
+        conditions.jitter_ms = 50;
+        conditions.bandwidth_bytes_per_second = 1000 * 1000;
+        conditions.failure_rate = 0.05;
+        return true;
+    }
+    if (spec == "high-rtt")
+    {
+        conditions.round_trip_ms = 600;
+        conditions.jitter_ms = 50;
+        conditions.bandwidth_bytes_per_second = 2500 * 1000;
+        return true;
+    }
+
+    std::istringstream stream(spec);
+    std::string setting;
+    while (std::getline(stream, setting, ','))
+    {
+        size_t equals = setting.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = setting.substr(0, equals);
+        const char* value = setting.c_str() + equals + 1;
+        if (name == "rtt")
+        {
+            conditions.round_trip_ms = std::strtol(value, nullptr, 10);
+        }
+        else if (name == "jitter")
+        {
+            conditions.jitter_ms = std::strtol(value, nullptr, 10);
+        }
+        else if (name == "bandwidth")
+        {
+            conditions.bandwidth_bytes_per_second = std::strtoull(value, nullptr, 10);
+        }
+        else if (name == "loss")
+        {
+            conditions.failure_rate = std::strtod(value, nullptr);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+EmulatedTransport::EmulatedTransport(std::unique_ptr<Transport> inner, const NetworkConditions& conditions)
+    :   inner(std::move(inner)),
+        conditions(conditions),
+        random(std::random_device()()),
+        requests(),
+        by_inner(),
+        link_updated_at(Clock::now()),
+        link_budget(0)
+{}
+
+bool EmulatedTransport::Start(TransportRequest& request)
+{
+    auto emulated = std::make_unique<Emulated>();
+    emulated->outer = &request;
+    emulated->inner.result.url = request.result.url;
+    emulated->inner.request_headers = request.request_headers;
+    emulated->inner.accept_encoding = request.accept_encoding;
+    emulated->started_at = Clock::now();
+    long delay = conditions.round_trip_ms;
+    if (conditions.jitter_ms > 0)
+    {
+        delay += std::uniform_int_distribution<long>(0, conditions.jitter_ms)(random);
+    }
+    emulated->send_at = emulated->started_at + std::chrono::milliseconds(delay);
+    emulated->first_byte_at = Clock::time_point();
+    emulated->sent = false;
+    emulated->received = false;
+    emulated->fail = std::bernoulli_distribution(std::min(std::max(conditions.failure_rate, 0.0), 1.0))(random);
+    emulated->delivered = 0;
+
+    by_inner[&emulated->inner] = emulated.get();
+    requests.push_back(std::move(emulated));
+    return true;
+}
+
+void EmulatedTransport::Abort(TransportRequest& request)
+{
+    auto found = std::find_if(requests.begin(), requests.end(),
+        [&request](const std::unique_ptr<Emulated>& emulated) { return emulated->outer == &request; });
+    if (found == requests.end())
+    {
+        return;
+    }
+    if ((*found)->sent && !(*found)->received)
+    {
+        inner->Abort((*found)->inner);
+    }
+    by_inner.erase(&(*found)->inner);
+    requests.erase(found);
+}
+
+void EmulatedTransport::Perform(std::vector<TransportRequest*>& completed)
+{
+    Clock::time_point now = Clock::now();
+    if (conditions.bandwidth_bytes_per_second > 0)
+    {
+        double bandwidth = static_cast<double>(conditions.bandwidth_bytes_per_second);
+        link_budget += bandwidth * std::chrono::duration<double>(now - link_updated_at).count();
+        link_budget = std::min(link_budget, std::max(bandwidth * kMaxLinkBurstSeconds, 16384.0));
+    }
+    link_updated_at = now;
+
+    std::vector<TransportRequest*> received;
+    inner->Perform(received);
+    for (TransportRequest* request : received)
+    {
+        by_inner[request]->received = true;
+    }
+
+    // the link serves transfers in the order they started, like a single congested pipe
+    for (auto& emulated : requests)
+    {
+        if (!emulated->sent)
+        {
+            if (now < emulated->send_at)
+            {
+                continue;
+            }
+            emulated->sent = true;
+            if (emulated->fail)
+            {
+                emulated->outer->result.curl_code = CURLE_RECV_ERROR;
+                Complete(*emulated, completed);
+                continue;
+            }
+            if (!inner->Start(emulated->inner))
+            {
+                emulated->outer->result.curl_code = CURLE_COULDNT_CONNECT;
+                Complete(*emulated, completed);
+                continue;
+            }
+        }
+        if (!emulated->received)
+        {
+            continue;
+        }
+
+        FetchResult& result = emulated->outer->result;
+        const std::string& body = emulated->inner.result.body;
+        if (emulated->first_byte_at == Clock::time_point())
+        {
+            emulated->first_byte_at = now;
+            result.status_code = emulated->inner.result.status_code;
+            result.headers = emulated->inner.result.headers;
+        }
+
+        size_t chunk = body.size() - emulated->delivered;
+        if (conditions.bandwidth_bytes_per_second > 0)
+        {
+            chunk = std::min(chunk, static_cast<size_t>(std::max(link_budget, 0.0)));
+            link_budget -= chunk;
+        }
+        if (chunk > 0)
+        {
+            if (emulated->delivered == 0)
+            {
+                emulated->outer->ReserveBody(body.size());
+            }
+            result.body.append(body, emulated->delivered, chunk);
+            emulated->delivered += chunk;
+            emulated->outer->BodyReceived();
+        }
+        if (emulated->delivered == body.size())
+        {
+            result.curl_code = emulated->inner.result.curl_code;
+            Complete(*emulated, completed);
+        }
+    }
+
+    requests.erase(std::remove_if(requests.begin(), requests.end(),
+        [](const std::unique_ptr<Emulated>& emulated) { return emulated->outer == nullptr; }), requests.end());
+}
+
+void EmulatedTransport::Wait(long timeout_ms)
+{
+    Clock::time_point now = Clock::now();
+    long wait = timeout_ms;
+    for (const auto& emulated : requests)
+    {
+        if (!emulated->sent)
+        {
+            wait = std::min(wait, milliseconds_until(emulated->send_at, now));
+        }
+        else if (emulated->received)
+        {
+            wait = std::min(wait, kDeliveryIntervalMs);
+        }
+    }
+    if (wait > 0)
+    {
+        inner->Wait(wait);
+    }
+}
+
+void EmulatedTransport::Wakeup()
+{
+    inner->Wakeup();
+}
+
+PoolStats EmulatedTransport::GetPoolStats() const
+{
+    return inner->GetPoolStats();
+}
+
+void EmulatedTransport::Complete(Emulated& emulated, std::vector<TransportRequest*>& completed)
+{
+    Clock::time_point now = Clock::now();
+    TransferTiming& timing = emulated.outer->timing;
+    timing = TransferTiming();
+    uint64_t total = microseconds_between(emulated.started_at, now);
+    if (emulated.first_byte_at != Clock::time_point())
+    {
+        uint64_t first_byte = microseconds_between(emulated.started_at, emulated.first_byte_at);
+        timing.phase_microseconds[static_cast<size_t>(TransferPhase::FirstByte)] = first_byte;
+        timing.phase_microseconds[static_cast<size_t>(TransferPhase::Download)] = total - std::min(total, first_byte);
+    }
+    timing.phase_microseconds[static_cast<size_t>(TransferPhase::Total)] = total;
+    timing.bytes = emulated.inner.timing.bytes;
+    timing.decoded_bytes = emulated.delivered;
+
+    completed.push_back(emulated.outer);
+    by_inner.erase(&emulated.inner);
+    emulated.outer = nullptr;
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Transport.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace curlhelpers
+{
+
+struct NetworkConditions
+{
+    // added before every request reaches the wrapped transport
+    long round_trip_ms { 0 };
+    // uniform extra delay in [0, jitter_ms] per request
+    long jitter_ms { 0 };
+    // shared by every transfer in flight; 0 is unlimited
+    uint64_t bandwidth_bytes_per_second { 0 };
+    // chance that a request fails with a receive error instead of being served
+    double failure_rate { 0 };
+
+    // Accepts a preset ("3g", "lossy", "high-rtt") or a comma separated list
+    // of rtt=<ms>, jitter=<ms>, bandwidth=<bytes/s> and loss=<fraction>.
+    static bool Parse(const std::string& spec, NetworkConditions& conditions);
+};
+
+// Wraps another transport and replays its responses as if they travelled over
+// a slower, less reliable link: requests wait out the round trip, bodies
+// trickle out at the link's bandwidth and some requests fail outright.
+class EmulatedTransport : public Transport
+{
+public:
+    EmulatedTransport(std::unique_ptr<Transport> inner, const NetworkConditions& conditions);
+
+    bool Start(TransportRequest& request) override;
+    void Abort(TransportRequest& request) override;
+    void Perform(std::vector<TransportRequest*>& completed) override;
+    void Wait(long timeout_ms) override;
+    void Wakeup() override;
+
+    PoolStats GetPoolStats() const override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Emulated
+    {
+        TransportRequest* outer;
+        // what the wrapped transport fills in before the link delivers it
+        TransportRequest inner;
+        Clock::time_point started_at;
+        Clock::time_point send_at;
+        Clock::time_point first_byte_at;
+        bool sent;
+        bool received;
+        bool fail;
+        size_t delivered;
+    };
+
+    void Complete(Emulated& emulated, std::vector<TransportRequest*>& completed);
+
+    std::unique_ptr<Transport> inner;
+    NetworkConditions conditions;
+    std::mt19937 random;
+    std::vector<std::unique_ptr<Emulated>> requests;
+    std::unordered_map<TransportRequest*, Emulated*> by_inner;
+    Clock::time_point link_updated_at;
+    double link_budget;
+};
+
+}
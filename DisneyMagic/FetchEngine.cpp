@@ -0,0 +1,1179 @@
+#include "FetchEngine.h"
+#include "CurlTransport.h"
+#include "EmulatedTransport.h"
+#include "LocalTransport.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+// Returns false when the response must not be stored at all.
+bool cache_lifetime(const FetchResult& result, std::time_t& max_age)
+{
+    max_age = 0;
+    const std::string* cache_control = result.Header("cache-control");
+    if (cache_control == nullptr)
+    {
+        return true;
+    }
+    if (cache_control->find("no-store") != std::string::npos)
+    {
+        return false;
+    }
+    size_t found = cache_control->find("max-age=");
+    if (found != std::string::npos && cache_control->find("no-cache") == std::string::npos)
+    {
+        max_age = std::strtol(cache_control->c_str() + found + 8, nullptr, 10);
+    }
+    return true;
+}
+
+// A 206 carries the whole resource when the range ran to the end and the body
+// already held everything before it, as a completed resume does.
+bool holds_whole_body(const FetchResult& result)
+{
+    uint64_t last { 0 };
+    uint64_t total { 0 };
+    return !result.IsPartial() && result.ContentRange(last, total) && result.body.size() == total;
+}
+
+bool is_transient(const FetchResult& result)
+{
+    switch (result.curl_code)
+    {
+        case CURLE_OK:
+            break;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return true;
+        default:
+            return false;
+    }
+    switch (result.status_code)
+    {
+        case 408:
+        case 429:
+        case 500:
+        case 502:
+        case 503:
+        case 504:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Latency samples kept for the hedging threshold, and how many are needed before hedging starts.
+const size_t kLatencySampleCount { 256 };
+const size_t kMinLatencySamples { 20 };
+// The cache thread flushes the index this often while it has nothing else to do.
+const std::chrono::seconds kCacheFlushPeriod { 10 };
+
+void check_status(FetchResult& result)
+{
+    if (result.curl_code != CURLE_OK)
+    {
+        result.error = "Curl perform failed with code: " + std::to_string(result.curl_code) + " (" + curl_easy_strerror(result.curl_code) + ")";
+    }
+    else if (result.status_code >= 400)
+    {
+        result.error = "HTTP request failed with status: " + std::to_string(result.status_code);
+    }
+}
+
+std::unique_ptr<Transport> make_base_transport(const FetchConfig& config)
+{
+    if (!config.replay_path.empty())
+    {
+        auto memory = std::make_unique<MemoryTransport>();
+        for (auto& response : HttpArchive::Load(config.replay_path))
+        {
+            memory->Add(std::move(response));
+        }
+        return memory;
+    }
+    if (!config.mirror_directory.empty())
+    {
+        return std::make_unique<DirectoryTransport>(config.mirror_directory);
+    }
+    std::unique_ptr<ResolverState> resolver_state;
+    if (!config.resolver_state_path.empty())
+    {
+        resolver_state = std::make_unique<ResolverState>(config.resolver_state_path, config.resolver_state_ttl_seconds);
+    }
+    return std::make_unique<CurlTransport>(
+        config.max_streams_per_host,
+        config.max_connections_per_host,
+        config.connect_timeout_ms,
+        config.total_timeout_ms,
+        std::move(resolver_state));
+}
+
+std::unique_ptr<Transport> make_transport(const FetchConfig& config)
+{
+    std::unique_ptr<Transport> transport = make_base_transport(config);
+    if (config.network_conditions.empty())
+    {
+        return transport;
+    }
+
+    NetworkConditions conditions;
+    if (!NetworkConditions::Parse(config.network_conditions, conditions))
+    {
+        throw std::runtime_error("Unknown network conditions: " + config.network_conditions);
+    }
+    return std::make_unique<EmulatedTransport>(std::move(transport), conditions);
+}
+
+}
+
+bool FetchRange::IsWhole() const
+{
+    return resume_from.empty() && max_bytes == 0;
+}
+
+FetchEngine::Transfer::~Transfer()
+{
+    if (buffers != nullptr)
+    {
+        buffers->Recycle(std::move(result.body));
+    }
+}
+
+void FetchEngine::Transfer::ReserveBody(size_t expected_size)
+{
+    receiving = true;
+    buffers->Recycle(std::move(result.body));
+    // a server that ignored the range sends the whole body, which replaces what was downloaded earlier
+    bool resuming = !range.resume_from.empty() && result.Header("content-range") != nullptr;
+    result.body = buffers->Acquire(expected_size + (resuming ? range.resume_from.size() : 0));
+    if (resuming)
+    {
+        result.body.assign(range.resume_from);
+    }
+    body_capacity = result.body.capacity();
+}
+
+void FetchEngine::Transfer::BodyReceived()
+{
+    if (result.body.capacity() != body_capacity)
+    {
+        buffers->CountGrowth();
+        body_capacity = result.body.capacity();
+    }
+
+    for (const auto& waiter : waiters)
+    {
+        if (waiter.progress)
+        {
+            waiter.progress(result.body);
+        }
+    }
+}
+
+FetchEngine::FetchEngine(const FetchConfig& config, std::unique_ptr<Transport> transport)
+    :   config(config),
+        transport(std::move(transport)),
+        // the startup burst multiplexes over few hosts, so the window starts at what one host takes
+        limiter(config.min_concurrency, config.max_concurrency, config.max_streams_per_host),
+        cache(),
+        negative_cache(config.negative_ttls),
+        archive(),
+        buffers(),
+        mutex(),
+        submitted(),
+        priority_changes(),
+        cancellations(),
+        preconnects(),
+        queued(),
+        backing_off(),
+        active(),
+        active_per_host(),
+        in_flight(),
+        waiting(),
+        stats(),
+        latency_samples(),
+        next_latency_sample(0),
+        hedge_threshold(0),
+        jitter(std::random_device()()),
+        next_id(1),
+        stopping(false),
+        io_thread(),
+        cache_mutex(),
+        cache_work(),
+        cache_reads(),
+        cache_reads_done(),
+        cache_writes(),
+        cache_stopping(false),
+        cache_thread()
+{
+    if (!this->transport)
+    {
+        this->transport = make_transport(config);
+    }
+    if (!config.cache_directory.empty())
+    {
+        cache = std::make_unique<DiskCache>(config.cache_directory, config.cache_max_bytes);
+    }
+    if (!config.record_path.empty())
+    {
+        archive = std::make_unique<HttpArchive>(config.record_path);
+    }
+    if (cache)
+    {
+        cache_thread = std::thread(&FetchEngine::RunCache, this);
+    }
+    io_thread = std::thread(&FetchEngine::Run, this);
+}
+
+FetchEngine::~FetchEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    transport->Wakeup();
+    io_thread.join();
+
+    // pending writes are finished and pending reads given up
+    if (cache_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache_stopping = true;
+        }
+        cache_work.notify_one();
+        cache_thread.join();
+    }
+    for (auto& transfer : cache_reads_done)
+    {
+        submitted.push_back(std::move(transfer));
+    }
+    cache_reads_done.clear();
+
+    for (auto& entry : active)
+    {
+        transport->Abort(*entry.first);
+        if (!entry.second->is_hedge)
+        {
+            submitted.push_back(std::move(entry.second));
+        }
+    }
+    active.clear();
+
+    for (auto& transfer : queued)
+    {
+        submitted.push_back(std::move(transfer));
+    }
+    queued.clear();
+
+    for (auto& transfer : backing_off)
+    {
+        submitted.push_back(std::move(transfer));
+    }
+    backing_off.clear();
+
+    for (auto& transfer : submitted)
+    {
+        transfer->result.error = "Fetch engine stopped before transfer completed";
+        Deliver(*transfer);
+    }
+    submitted.clear();
+}
+
+PoolStats FetchEngine::GetPoolStats() const
+{
+    return transport->GetPoolStats();
+}
+
+BufferStats FetchEngine::GetBufferStats() const
+{
+    return buffers.GetStats();
+}
+
+CacheStats FetchEngine::GetCacheStats() const
+{
+    return cache ? cache->GetStats() : CacheStats();
+}
+
+EngineStats FetchEngine::GetEngineStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+LimiterStats FetchEngine::GetLimiterStats() const
+{
+    return limiter.GetStats();
+}
+
+void FetchEngine::ReportMetrics(std::ostream& out) const
+{
+    metrics.Report(out);
+}
+
+FetchEngine& FetchEngine::Instance()
+{
+    static FetchEngine engine(DefaultConfig());
+    return engine;
+}
+
+// DISNEYMAGIC_RECORD and DISNEYMAGIC_REPLAY name an archive file to record to or
+// replay from, DISNEYMAGIC_MIRROR a directory to serve requests from and
+// DISNEYMAGIC_NETWORK the link conditions to emulate.
+FetchConfig FetchEngine::DefaultConfig()
+{
+    FetchConfig config;
+    if (const char* record_path = std::getenv("DISNEYMAGIC_RECORD"))
+    {
+        config.record_path = record_path;
+    }
+    if (const char* replay_path = std::getenv("DISNEYMAGIC_REPLAY"))
+    {
+        config.replay_path = replay_path;
+    }
+    if (const char* mirror_directory = std::getenv("DISNEYMAGIC_MIRROR"))
+    {
+        config.mirror_directory = mirror_directory;
+    }
+    if (const char* network_conditions = std::getenv("DISNEYMAGIC_NETWORK"))
+    {
+        config.network_conditions = network_conditions;
+    }
+
+    // offline runs must not depend on what earlier runs left in the cache
+    if (config.replay_path.empty() && config.mirror_directory.empty())
+    {
+        config.cache_directory = DiskCache::DefaultDirectory();
+        config.resolver_state_path = ResolverState::DefaultPath();
+    }
+    return config;
+}
+
+std::future<FetchResult> FetchEngine::Submit(
+    const std::string& url,
+    RequestKind kind,
+    FetchPriority priority,
+    RequestId* id,
+    FetchProgress progress,
+    FetchRange range)
+{
+    auto promise = std::make_shared<std::promise<FetchResult>>();
+    auto future = promise->get_future();
+    RequestId submitted_id = Submit(url, kind, priority, [promise](FetchResult& result)
+    {
+        promise->set_value(std::move(result));
+    }, std::move(progress), std::move(range));
+    if (id != nullptr)
+    {
+        *id = submitted_id;
+    }
+    return future;
+}
+
+RequestId FetchEngine::Submit(
+    const std::string& url,
+    RequestKind kind,
+    FetchPriority priority,
+    FetchCallback callback,
+    FetchProgress progress,
+    FetchRange range)
+{
+    auto transfer = std::make_unique<Transfer>();
+    transfer->buffers = &buffers;
+    transfer->body_capacity = 0;
+    transfer->host = ConnectionPool::HostOf(url);
+    transfer->kind = kind;
+    // images are already compressed, so only the JSON documents gain from content encoding
+    transfer->accept_encoding = kind != RequestKind::TileImage && range.IsWhole();
+    transfer->key = url;
+    if (!range.IsWhole())
+    {
+        std::string bytes = std::to_string(range.resume_from.size()) + "-";
+        if (range.max_bytes > 0)
+        {
+            bytes += std::to_string(range.resume_from.size() + range.max_bytes - 1);
+        }
+        transfer->key += " bytes=" + bytes;
+        transfer->request_headers.push_back("Range: bytes=" + bytes);
+    }
+    transfer->range = std::move(range);
+    transfer->priority = priority;
+    transfer->on_wire = false;
+    transfer->receiving = false;
+    transfer->cache_hit = false;
+    transfer->revalidating = false;
+    transfer->from_negative_cache = false;
+    transfer->attempts = 0;
+    transfer->twin = nullptr;
+    transfer->is_hedge = false;
+    transfer->hedged = false;
+    transfer->result.url = url;
+
+    RequestId id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = next_id++;
+        transfer->id = id;
+        transfer->waiters.push_back(Waiter { id, priority, std::move(callback), std::move(progress) });
+        submitted.push_back(std::move(transfer));
+        ++stats.requests;
+    }
+    transport->Wakeup();
+    return id;
+}
+
+void FetchEngine::Reprioritize(RequestId id, FetchPriority priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        priority_changes.emplace_back(id, priority);
+    }
+    transport->Wakeup();
+}
+
+void FetchEngine::Cancel(RequestId id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancellations.push_back(id);
+    }
+    transport->Wakeup();
+}
+
+void FetchEngine::Preconnect(const std::string& url)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        preconnects.push_back(url);
+    }
+    transport->Wakeup();
+}
+
+void FetchEngine::Recycle(std::string body)
+{
+    buffers.Recycle(std::move(body));
+}
+
+void FetchEngine::Run()
+{
+    while (true)
+    {
+        std::deque<std::unique_ptr<Transfer>> incoming;
+        std::vector<std::pair<RequestId, FetchPriority>> changes;
+        std::vector<RequestId> cancelled;
+        std::vector<std::string> warm_ups;
+        std::deque<std::unique_ptr<Transfer>> read;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+            {
+                break;
+            }
+            incoming.swap(submitted);
+            changes.swap(priority_changes);
+            cancelled.swap(cancellations);
+            warm_ups.swap(preconnects);
+        }
+        if (cache)
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            read.swap(cache_reads_done);
+        }
+
+        for (auto& transfer : read)
+        {
+            CompleteFromCache(std::move(transfer));
+        }
+        for (auto& transfer : incoming)
+        {
+            Admit(std::move(transfer));
+        }
+        for (const auto& change : changes)
+        {
+            ApplyPriorityChange(change.first, change.second);
+        }
+        for (RequestId id : cancelled)
+        {
+            ApplyCancellation(id);
+        }
+
+        Clock::time_point now = Clock::now();
+        for (auto it = backing_off.begin(); it != backing_off.end();)
+        {
+            if ((*it)->retry_at <= now)
+            {
+                queued.push_back(std::move(*it));
+                it = backing_off.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        StartQueuedTransfers();
+
+        for (const std::string& url : warm_ups)
+        {
+            // a transfer already on its way to the host is doing the warm-up
+            if (active_per_host[ConnectionPool::HostOf(url)] == 0)
+            {
+                transport->Preconnect(url);
+            }
+        }
+
+        std::vector<TransportRequest*> completed;
+        transport->Perform(completed);
+        for (TransportRequest* request : completed)
+        {
+            FinishTransfer(static_cast<Transfer*>(request));
+        }
+        StartQueuedTransfers();
+        StartHedges();
+
+        transport->Wait(PollTimeout());
+    }
+}
+
+void FetchEngine::RunCache()
+{
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    while (true)
+    {
+        if (!cache_reads.empty())
+        {
+            std::unique_ptr<Transfer> transfer = std::move(cache_reads.front());
+            cache_reads.pop_front();
+            if (!cache_stopping)
+            {
+                lock.unlock();
+                // only the body and the entry are touched here; the I/O thread leaves them alone until the read is done
+                transfer->cache_hit = cache->Lookup(transfer->result.url, transfer->cached, transfer->result.body);
+                lock.lock();
+            }
+            cache_reads_done.push_back(std::move(transfer));
+            transport->Wakeup();
+            continue;
+        }
+        if (!cache_writes.empty())
+        {
+            CacheWrite write = std::move(cache_writes.front());
+            cache_writes.pop_front();
+            lock.unlock();
+            cache->Store(write.url, write.entry, write.body);
+            buffers.Recycle(std::move(write.body));
+            lock.lock();
+            continue;
+        }
+        if (cache_stopping)
+        {
+            break;
+        }
+
+        lock.unlock();
+        cache->Flush();
+        lock.lock();
+        cache_work.wait_for(lock, kCacheFlushPeriod,
+            [this] { return cache_stopping || !cache_reads.empty() || !cache_writes.empty(); });
+    }
+}
+
+void FetchEngine::Admit(std::unique_ptr<Transfer> transfer)
+{
+    auto joined = in_flight.find(transfer->key);
+    if (joined != in_flight.end())
+    {
+        Transfer& existing = *joined->second;
+        existing.priority = std::min(existing.priority, transfer->priority);
+        for (auto& waiter : transfer->waiters)
+        {
+            waiting[waiter.id] = &existing;
+            existing.waiters.push_back(std::move(waiter));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.coalesced;
+        return;
+    }
+
+    uint64_t cached_size { 0 };
+    if (cache && cache->Contains(transfer->result.url, cached_size))
+    {
+        ReadFromCache(std::move(transfer), cached_size);
+        return;
+    }
+    Dispatch(std::move(transfer));
+}
+
+void FetchEngine::Dispatch(std::unique_ptr<Transfer> transfer)
+{
+    if (negative_cache.Lookup(transfer->result.url, transfer->host, transfer->result))
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++stats.negative_hits;
+        }
+        transfer->from_negative_cache = true;
+        LeaveInFlight(*transfer);
+        Deliver(*transfer);
+        return;
+    }
+
+    // background revalidations must not capture new requests, which the cache can serve
+    if (!transfer->revalidating)
+    {
+        in_flight[transfer->key] = transfer.get();
+        for (const auto& waiter : transfer->waiters)
+        {
+            waiting[waiter.id] = transfer.get();
+        }
+    }
+    queued.push_back(std::move(transfer));
+}
+
+void FetchEngine::ApplyPriorityChange(RequestId id, FetchPriority priority)
+{
+    auto found = waiting.find(id);
+    if (found == waiting.end())
+    {
+        return;
+    }
+
+    Transfer& transfer = *found->second;
+    transfer.priority = FetchPriority::Prefetch;
+    for (auto& waiter : transfer.waiters)
+    {
+        if (waiter.id == id)
+        {
+            waiter.priority = priority;
+        }
+        transfer.priority = std::min(transfer.priority, waiter.priority);
+    }
+}
+
+void FetchEngine::ApplyCancellation(RequestId id)
+{
+    auto found = waiting.find(id);
+    if (found == waiting.end())
+    {
+        // already delivered
+        return;
+    }
+    Transfer* transfer = found->second;
+    waiting.erase(found);
+
+    auto waiter = std::find_if(transfer->waiters.begin(), transfer->waiters.end(),
+        [id](const Waiter& candidate) { return candidate.id == id; });
+    if (waiter != transfer->waiters.end())
+    {
+        FetchResult result;
+        result.url = transfer->result.url;
+        result.error = "Request cancelled";
+        result.cancelled = true;
+        FetchCallback callback = std::move(waiter->callback);
+        transfer->waiters.erase(waiter);
+        callback(result);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.cancelled;
+    }
+
+    if (transfer->waiters.empty() && transfer->on_wire)
+    {
+        // a body already arriving is left to finish into the cache and stays
+        // joinable; one still waiting for its first byte is aborted with its hedge
+        if (transfer->receiving || (transfer->twin != nullptr && transfer->twin->receiving))
+        {
+            return;
+        }
+        LeaveInFlight(*transfer);
+        if (Transfer* twin = transfer->twin)
+        {
+            twin->twin = nullptr;
+            transport->Abort(*twin);
+            Detach(twin);
+        }
+        transport->Abort(*transfer);
+        Detach(transfer);
+    }
+    else if (transfer->waiters.empty())
+    {
+        LeaveInFlight(*transfer);
+        auto is_transfer = [transfer](const std::unique_ptr<Transfer>& candidate) { return candidate.get() == transfer; };
+        auto queued_transfer = std::find_if(queued.begin(), queued.end(), is_transfer);
+        if (queued_transfer != queued.end())
+        {
+            queued.erase(queued_transfer);
+        }
+        auto waiting_transfer = std::find_if(backing_off.begin(), backing_off.end(), is_transfer);
+        if (waiting_transfer != backing_off.end())
+        {
+            backing_off.erase(waiting_transfer);
+        }
+    }
+    else
+    {
+        ApplyPriorityChange(transfer->waiters.front().id, transfer->waiters.front().priority);
+    }
+}
+
+// Hands the transfer to the cache thread. It is joinable while the body is
+// read, so requests for the same URL arriving meanwhile share the read.
+void FetchEngine::ReadFromCache(std::unique_ptr<Transfer> transfer, uint64_t body_size)
+{
+    in_flight[transfer->key] = transfer.get();
+    for (const auto& waiter : transfer->waiters)
+    {
+        waiting[waiter.id] = transfer.get();
+    }
+    // sized from the index, so a small document does not take the largest idle buffer
+    transfer->result.body = buffers.Acquire(static_cast<size_t>(body_size));
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache_reads.push_back(std::move(transfer));
+    }
+    cache_work.notify_one();
+}
+
+// Delivers a body the cache thread read. A stale entry is delivered right away
+// and the transfer is kept to revalidate it in the background; an entry that
+// went missing sends the transfer to the network.
+void FetchEngine::CompleteFromCache(std::unique_ptr<Transfer> transfer)
+{
+    if (transfer->waiters.empty())
+    {
+        // every request was cancelled during the read
+        LeaveInFlight(*transfer);
+        return;
+    }
+    if (!transfer->cache_hit)
+    {
+        buffers.Recycle(std::move(transfer->result.body));
+        Dispatch(std::move(transfer));
+        return;
+    }
+
+    metrics.RecordCacheHit(transfer->kind);
+
+    LeaveInFlight(*transfer);
+    std::string url = transfer->result.url;
+    transfer->result.status_code = 200;
+    transfer->result.from_cache = true;
+    Deliver(*transfer);
+
+    buffers.Recycle(std::move(transfer->result.body));
+    transfer->result = FetchResult();
+    transfer->result.url = url;
+
+    const CacheEntry& entry = transfer->cached;
+    if (entry.IsFresh(std::time(nullptr)))
+    {
+        return;
+    }
+
+    transfer->revalidating = true;
+    transfer->priority = FetchPriority::Prefetch;
+    if (!transfer->range.IsWhole())
+    {
+        // the cache holds the whole body, so the whole body is what gets revalidated
+        transfer->range = FetchRange();
+        transfer->key = transfer->result.url;
+        transfer->request_headers.erase(std::remove_if(transfer->request_headers.begin(), transfer->request_headers.end(),
+            [](const std::string& header) { return header.compare(0, 6, "Range:") == 0; }), transfer->request_headers.end());
+    }
+    if (!entry.etag.empty())
+    {
+        transfer->request_headers.push_back("If-None-Match: " + entry.etag);
+    }
+    if (!entry.last_modified.empty())
+    {
+        transfer->request_headers.push_back("If-Modified-Since: " + entry.last_modified);
+    }
+    Dispatch(std::move(transfer));
+}
+
+void FetchEngine::UpdateCache(const Transfer& transfer)
+{
+    const FetchResult& result = transfer.result;
+    if (!cache || result.curl_code != CURLE_OK)
+    {
+        return;
+    }
+
+    std::time_t max_age { 0 };
+    if (!cache_lifetime(result, max_age))
+    {
+        return;
+    }
+
+    if (result.status_code == 304 && transfer.revalidating)
+    {
+        cache->Refresh(result.url, max_age);
+    }
+    else if (result.status_code == 200 || holds_whole_body(result))
+    {
+        CacheEntry entry;
+        if (const std::string* etag = result.Header("etag"))
+        {
+            entry.etag = *etag;
+        }
+        if (const std::string* last_modified = result.Header("last-modified"))
+        {
+            entry.last_modified = *last_modified;
+        }
+        entry.stored_at = std::time(nullptr);
+        entry.max_age = max_age;
+        // the waiters take the body, so the cache thread writes a copy
+        CacheWrite write { result.url, entry, buffers.Acquire(result.body.size()) };
+        write.body.assign(result.body);
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache_writes.push_back(std::move(write));
+        }
+        cache_work.notify_one();
+    }
+}
+
+void FetchEngine::Deliver(Transfer& transfer)
+{
+    const FetchResult& result = transfer.result;
+    // partial bodies would stand in for the whole resource on replay, and only
+    // the first record of a URL is kept, so nothing the server did not send is recorded
+    // the disk cache keeps no headers, so its hits are not recorded either
+    if (archive && result.curl_code == CURLE_OK && result.status_code != 0 && result.error.empty() &&
+        result.status_code != 304 && result.status_code != 206 && !transfer.from_negative_cache && !result.from_cache)
+    {
+        ArchivedResponse response;
+        response.url = result.url;
+        response.status_code = result.status_code;
+        response.headers = result.headers;
+        response.body = result.body;
+        archive->Record(std::move(response));
+    }
+
+    if (transfer.waiters.size() > 1)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.coalesced_bytes += transfer.result.body.size() * (transfer.waiters.size() - 1);
+    }
+
+    // every waiter but the last gets a copy so the last can take the body without copying
+    for (size_t index = 0; index < transfer.waiters.size(); ++index)
+    {
+        waiting.erase(transfer.waiters[index].id);
+        if (index + 1 < transfer.waiters.size())
+        {
+            FetchResult copy = transfer.result;
+            transfer.waiters[index].callback(copy);
+        }
+        else
+        {
+            transfer.waiters[index].callback(transfer.result);
+        }
+    }
+    transfer.waiters.clear();
+}
+
+void FetchEngine::StartQueuedTransfers()
+{
+    size_t window = limiter.Window();
+    for (FetchPriority priority : { FetchPriority::Visible, FetchPriority::NearViewport, FetchPriority::Prefetch })
+    {
+        for (auto it = queued.begin(); it != queued.end() && active.size() < window;)
+        {
+            if ((*it)->priority == priority && active_per_host[(*it)->host] < config.max_streams_per_host)
+            {
+                std::unique_ptr<Transfer> transfer = std::move(*it);
+                it = queued.erase(it);
+                StartTransfer(std::move(transfer));
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    if (active.size() >= window || !queued.empty())
+    {
+        limiter.OnSaturated();
+    }
+}
+
+void FetchEngine::StartTransfer(std::unique_ptr<Transfer> transfer)
+{
+    transfer->started_at = Clock::now();
+    if (!transport->Start(*transfer))
+    {
+        if (transfer->is_hedge)
+        {
+            transfer->twin->twin = nullptr;
+            return;
+        }
+        transfer->result.error = "Transport failed to start transfer";
+        LeaveInFlight(*transfer);
+        Deliver(*transfer);
+        return;
+    }
+
+    transfer->on_wire = true;
+    ++active_per_host[transfer->host];
+    Transfer* key = transfer.get();
+    active.emplace(key, std::move(transfer));
+}
+
+void FetchEngine::StartHedges()
+{
+    if (!config.hedge_requests || hedge_threshold <= 0)
+    {
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    size_t window = limiter.Window();
+    std::vector<Transfer*> candidates;
+    for (auto& entry : active)
+    {
+        Transfer& transfer = *entry.second;
+        if (!transfer.hedged &&
+            std::chrono::duration<double>(now - transfer.started_at).count() > hedge_threshold)
+        {
+            candidates.push_back(&transfer);
+        }
+    }
+
+    // hedges only use spare capacity so they never delay requests still waiting to start
+    for (Transfer* primary : candidates)
+    {
+        if (active.size() >= window || !queued.empty())
+        {
+            break;
+        }
+        if (active_per_host[primary->host] >= config.max_streams_per_host)
+        {
+            continue;
+        }
+
+        auto hedge = std::make_unique<Transfer>();
+        hedge->buffers = &buffers;
+        hedge->body_capacity = 0;
+        hedge->id = primary->id;
+        hedge->key = primary->key;
+        hedge->range = primary->range;
+        hedge->host = primary->host;
+        hedge->kind = primary->kind;
+        hedge->accept_encoding = primary->accept_encoding;
+        hedge->priority = primary->priority;
+        hedge->on_wire = false;
+        hedge->receiving = false;
+        hedge->cache_hit = false;
+        hedge->request_headers = primary->request_headers;
+        hedge->revalidating = primary->revalidating;
+        hedge->from_negative_cache = false;
+        hedge->attempts = primary->attempts;
+        hedge->twin = primary;
+        hedge->is_hedge = true;
+        hedge->hedged = true;
+        hedge->result.url = primary->result.url;
+
+        primary->twin = hedge.get();
+        primary->hedged = true;
+        StartTransfer(std::move(hedge));
+        if (primary->twin != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++stats.hedges;
+        }
+    }
+}
+
+void FetchEngine::FinishTransfer(Transfer* finished)
+{
+    if (active.find(finished) == active.end())
+    {
+        return;
+    }
+
+    FetchResult& result = finished->result;
+    check_status(result);
+
+    TransferTiming timing = finished->timing;
+    timing.failed = !result.Succeeded();
+    metrics.RecordTransfer(finished->kind, timing);
+
+    // everything before the download phase is the time to first byte
+    uint64_t first_byte_time = timing.phase_microseconds[static_cast<size_t>(TransferPhase::Total)] -
+        timing.phase_microseconds[static_cast<size_t>(TransferPhase::Download)];
+    limiter.OnComplete(first_byte_time / 1e6, timing.bytes, result.curl_code != CURLE_OK);
+    if (result.Succeeded())
+    {
+        RecordLatency(timing.phase_microseconds[static_cast<size_t>(TransferPhase::Total)] / 1e6);
+    }
+
+    std::unique_ptr<Transfer> transfer = Detach(finished);
+    if (Transfer* twin = transfer->twin)
+    {
+        twin->twin = nullptr;
+        transfer->twin = nullptr;
+        if (!transfer->result.Succeeded())
+        {
+            // the other half is still running and answers for both
+            TransferWaiters(*transfer, *twin);
+            twin->is_hedge = false;
+            return;
+        }
+
+        transport->Abort(*twin);
+        std::unique_ptr<Transfer> loser = Detach(twin);
+        TransferWaiters(*loser, *transfer);
+        transfer->is_hedge = false;
+        if (loser->is_hedge)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++stats.hedge_wins;
+        }
+    }
+
+    if (ScheduleRetry(transfer))
+    {
+        return;
+    }
+
+    if (!transfer->result.Succeeded())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.failures;
+    }
+    negative_cache.Record(transfer->result, transfer->host);
+
+    LeaveInFlight(*transfer);
+    UpdateCache(*transfer);
+    Deliver(*transfer);
+}
+
+std::unique_ptr<FetchEngine::Transfer> FetchEngine::Detach(Transfer* transfer)
+{
+    auto found = active.find(transfer);
+    std::unique_ptr<Transfer> detached = std::move(found->second);
+    active.erase(found);
+    --active_per_host[detached->host];
+    detached->on_wire = false;
+    return detached;
+}
+
+void FetchEngine::TransferWaiters(Transfer& from, Transfer& to)
+{
+    for (auto& waiter : from.waiters)
+    {
+        waiting[waiter.id] = &to;
+        to.waiters.push_back(std::move(waiter));
+    }
+    from.waiters.clear();
+
+    auto joinable = in_flight.find(from.key);
+    if (joinable != in_flight.end() && joinable->second == &from)
+    {
+        joinable->second = &to;
+    }
+}
+
+void FetchEngine::LeaveInFlight(const Transfer& transfer)
+{
+    // revalidations and hedges share their key with whichever transfer took the slot
+    auto joinable = in_flight.find(transfer.key);
+    if (joinable != in_flight.end() && joinable->second == &transfer)
+    {
+        in_flight.erase(joinable);
+    }
+}
+
+bool FetchEngine::ScheduleRetry(std::unique_ptr<Transfer>& transfer)
+{
+    if (transfer->result.Succeeded() || !is_transient(transfer->result) || transfer->attempts >= config.max_retries)
+    {
+        return false;
+    }
+
+    long ceiling = config.retry_base_delay_ms << std::min(transfer->attempts, 16u);
+    ceiling = std::min(ceiling, config.retry_max_delay_ms);
+    ++transfer->attempts;
+    transfer->hedged = false;
+    transfer->receiving = false;
+    long delay = std::uniform_int_distribution<long>(0, std::max(ceiling, 0L))(jitter);
+    transfer->retry_at = Clock::now() + std::chrono::milliseconds(delay);
+
+    std::string url = transfer->result.url;
+    buffers.Recycle(std::move(transfer->result.body));
+    transfer->result = FetchResult();
+    transfer->result.url = url;
+    backing_off.push_back(std::move(transfer));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.retries;
+    return true;
+}
+
+void FetchEngine::RecordLatency(double seconds)
+{
+    if (latency_samples.size() < kLatencySampleCount)
+    {
+        latency_samples.push_back(seconds);
+    }
+    else
+    {
+        latency_samples[next_latency_sample] = seconds;
+        next_latency_sample = (next_latency_sample + 1) % kLatencySampleCount;
+    }
+
+    if (latency_samples.size() >= kMinLatencySamples)
+    {
+        std::vector<double> sorted(latency_samples);
+        auto p95 = sorted.begin() + (sorted.size() * 95) / 100;
+        std::nth_element(sorted.begin(), p95, sorted.end());
+        hedge_threshold = *p95;
+    }
+}
+
+// Wakes up in time for the next retry or hedge even when no socket is active.
+long FetchEngine::PollTimeout() const
+{
+    Clock::time_point now = Clock::now();
+    Clock::time_point wake = now + std::chrono::seconds(1);
+    for (const auto& transfer : backing_off)
+    {
+        wake = std::min(wake, transfer->retry_at);
+    }
+    if (config.hedge_requests && hedge_threshold > 0)
+    {
+        auto threshold = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(hedge_threshold));
+        for (const auto& entry : active)
+        {
+            // transfers already past the threshold wait for capacity, which only a completion frees
+            Clock::time_point hedge_at = entry.second->started_at + threshold;
+            if (!entry.second->hedged && hedge_at > now)
+            {
+                wake = std::min(wake, hedge_at);
+            }
+        }
+    }
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count();
+    return std::max<long>(static_cast<long>(timeout), 1);
+}
+
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "BufferPool.h"
+#include "ConcurrencyLimiter.h"
+#include "ConnectionPool.h"
+#include "DiskCache.h"
+#include "FetchMetrics.h"
+#include "HttpArchive.h"
+#include "NegativeCache.h"
+#include "Transport.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace curlhelpers
+{
+
+using RequestId = uint64_t;
+
+// Queued transfers start in this order; within a class they start first come first served.
+enum class FetchPriority
+{
+    Visible,
+    NearViewport,
+    Prefetch
+};
+
+struct FetchConfig
+{
+    // HTTP/2 streams multiplexed per host; also caps HTTP/1.1 transfers when falling back
+    size_t max_streams_per_host { 16 };
+    long max_connections_per_host { 6 };
+    // bounds for the adaptive limit on transfers in flight across all hosts, which starts at max_streams_per_host
+    size_t min_concurrency { 2 };
+    size_t max_concurrency { 32 };
+    long connect_timeout_ms { 5000 };
+    // resolved addresses are saved here for the next launch; an empty path disables it
+    std::string resolver_state_path;
+    long resolver_state_ttl_seconds { 3600 };
+    long total_timeout_ms { 30000 };
+    // transient failures are retried with full-jitter exponential backoff
+    unsigned max_retries { 2 };
+    long retry_base_delay_ms { 250 };
+    long retry_max_delay_ms { 4000 };
+    // duplicate a transfer that outlives the p95 latency and keep whichever finishes first
+    bool hedge_requests { true };
+    // failures that tend to repeat are answered from memory for a while
+    NegativeCacheTtls negative_ttls;
+    // an empty directory disables the disk cache
+    std::string cache_directory;
+    uint64_t cache_max_bytes { 256ull * 1024 * 1024 };
+    // save every response to this archive file
+    std::string record_path;
+    // serve every request from this archive file and never touch the network
+    std::string replay_path;
+    // serve every request from a directory mirroring the URLs, see DirectoryTransport
+    std::string mirror_directory;
+    // emulate a slower link on top of the transport, see NetworkConditions::Parse
+    std::string network_conditions;
+};
+
+struct EngineStats
+{
+    uint64_t requests { 0 };
+    // requests that joined a transfer already in flight for the same URL
+    uint64_t coalesced { 0 };
+    uint64_t coalesced_bytes { 0 };
+    uint64_t cancelled { 0 };
+    uint64_t failures { 0 };
+    // requests failed at once from the negative cache
+    uint64_t negative_hits { 0 };
+    uint64_t retries { 0 };
+    uint64_t hedges { 0 };
+    uint64_t hedge_wins { 0 };
+};
+
+// Limits a request to part of a resource with an HTTP Range request. Ranged
+// requests only coalesce with requests for the same range. A server that
+// ignores the range answers 200 with the whole body, and so does the disk
+// cache when it holds the resource.
+struct FetchRange
+{
+    // the start of the body, downloaded earlier; only what follows is fetched
+    // and the result carries the whole body
+    std::string resume_from;
+    // fetch no more than this many bytes; zero fetches to the end
+    uint64_t max_bytes { 0 };
+
+    bool IsWhole() const;
+};
+
+// Callbacks are invoked on the engine's I/O thread and must not block.
+using FetchCallback = std::function<void(FetchResult&)>;
+// Receives the body downloaded so far each time more of it arrives. The body
+// starts over from the beginning when a transfer is retried.
+using FetchProgress = std::function<void(const std::string&)>;
+
+// Schedules transfers over a transport on a dedicated I/O thread.
+class FetchEngine
+{
+public:
+    // Without a transport the engine picks one from the config, normally a CurlTransport.
+    explicit FetchEngine(const FetchConfig& config = FetchConfig(), std::unique_ptr<Transport> transport = nullptr);
+    ~FetchEngine();
+
+    FetchEngine(const FetchEngine&) = delete;
+    FetchEngine& operator=(const FetchEngine&) = delete;
+
+    std::future<FetchResult> Submit(
+        const std::string& url,
+        RequestKind kind = RequestKind::Other,
+        FetchPriority priority = FetchPriority::Visible,
+        RequestId* id = nullptr,
+        FetchProgress progress = FetchProgress(),
+        FetchRange range = FetchRange());
+    RequestId Submit(
+        const std::string& url,
+        RequestKind kind,
+        FetchPriority priority,
+        FetchCallback callback,
+        FetchProgress progress = FetchProgress(),
+        FetchRange range = FetchRange());
+
+    // A priority change only affects requests that have not started yet. A
+    // cancelled request completes with FetchResult::cancelled set at once. Once
+    // every request waiting on a transfer is cancelled, the transfer is dropped,
+    // unless its body is already arriving, in which case it finishes into the cache.
+    void Reprioritize(RequestId id, FetchPriority priority);
+    void Cancel(RequestId id);
+
+    // Hands a body back for reuse once the caller is done with it, for example
+    // after decoding an image straight out of FetchResult::body.
+    void Recycle(std::string body);
+
+    // Warms up DNS and a connection to the URL's host before anything is requested from it.
+    void Preconnect(const std::string& url);
+
+    PoolStats GetPoolStats() const;
+    CacheStats GetCacheStats() const;
+    EngineStats GetEngineStats() const;
+    LimiterStats GetLimiterStats() const;
+    BufferStats GetBufferStats() const;
+    void ReportMetrics(std::ostream& out) const;
+
+    // The config Instance is created with.
+    static FetchConfig DefaultConfig();
+    static FetchEngine& Instance();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Waiter
+    {
+        RequestId id;
+        FetchPriority priority;
+        FetchCallback callback;
+        FetchProgress progress;
+    };
+
+    struct Transfer : TransportRequest
+    {
+        ~Transfer() override;
+
+        void ReserveBody(size_t expected_size) override;
+        void BodyReceived() override;
+
+        // bodies are received into buffers from here and returned to it unless a waiter takes them
+        BufferPool* buffers;
+        size_t body_capacity;
+        RequestId id;
+        // the URL, plus the range for ranged requests; requests with the same key coalesce
+        std::string key;
+        FetchRange range;
+        std::string host;
+        RequestKind kind;
+        FetchPriority priority;
+        bool on_wire;
+        // the first body bytes of this attempt have arrived
+        bool receiving;
+        // set by the cache thread when the body was read from disk
+        bool cache_hit;
+        CacheEntry cached;
+        bool revalidating;
+        // the result was replayed from the negative cache rather than received
+        bool from_negative_cache;
+        unsigned attempts;
+        Clock::time_point started_at;
+        Clock::time_point retry_at;
+        // the other half of a hedged pair while both are on the wire
+        Transfer* twin;
+        bool is_hedge;
+        // each attempt is hedged at most once
+        bool hedged;
+        std::vector<Waiter> waiters;
+    };
+
+    struct CacheWrite
+    {
+        std::string url;
+        CacheEntry entry;
+        std::string body;
+    };
+
+    void Run();
+    void RunCache();
+    void Admit(std::unique_ptr<Transfer> transfer);
+    // Queues the transfer for the network unless the negative cache answers it.
+    void Dispatch(std::unique_ptr<Transfer> transfer);
+    void ApplyPriorityChange(RequestId id, FetchPriority priority);
+    void ApplyCancellation(RequestId id);
+    void Deliver(Transfer& transfer);
+    void ReadFromCache(std::unique_ptr<Transfer> transfer, uint64_t body_size);
+    void CompleteFromCache(std::unique_ptr<Transfer> transfer);
+    void UpdateCache(const Transfer& transfer);
+    void StartQueuedTransfers();
+    void StartTransfer(std::unique_ptr<Transfer> transfer);
+    void StartHedges();
+    void FinishTransfer(Transfer* finished);
+    std::unique_ptr<Transfer> Detach(Transfer* transfer);
+    void TransferWaiters(Transfer& from, Transfer& to);
+    // Stops new requests coalescing with the transfer, unless another one has its key.
+    void LeaveInFlight(const Transfer& transfer);
+    bool ScheduleRetry(std::unique_ptr<Transfer>& transfer);
+    void RecordLatency(double seconds);
+    long PollTimeout() const;
+
+    FetchConfig config;
+    std::unique_ptr<Transport> transport;
+    ConcurrencyLimiter limiter;
+    std::unique_ptr<DiskCache> cache;
+    NegativeCache negative_cache;
+    // set when recording
+    std::unique_ptr<HttpArchive> archive;
+    // declared before the transfers so it outlives them
+    BufferPool buffers;
+    mutable std::mutex mutex;
+    std::deque<std::unique_ptr<Transfer>> submitted;
+    std::vector<std::pair<RequestId, FetchPriority>> priority_changes;
+    std::vector<RequestId> cancellations;
+    std::vector<std::string> preconnects;
+    std::deque<std::unique_ptr<Transfer>> queued;
+    std::vector<std::unique_ptr<Transfer>> backing_off;
+    std::unordered_map<Transfer*, std::unique_ptr<Transfer>> active;
+    std::unordered_map<std::string, size_t> active_per_host;
+    // network transfers that new requests for the same key can join
+    std::unordered_map<std::string, Transfer*> in_flight;
+    // the transfer each undelivered request is waiting on
+    std::unordered_map<RequestId, Transfer*> waiting;
+    EngineStats stats;
+    FetchMetrics metrics;
+    std::vector<double> latency_samples;
+    size_t next_latency_sample;
+    double hedge_threshold;
+    std::mt19937 jitter;
+    RequestId next_id;
+    bool stopping;
+    std::thread io_thread;
+    // cache bodies are read and written on a thread of their own so the I/O
+    // thread never waits on the disk; reads are served before writes
+    std::mutex cache_mutex;
+    std::condition_variable cache_work;
+    std::deque<std::unique_ptr<Transfer>> cache_reads;
+    std::deque<std::unique_ptr<Transfer>> cache_reads_done;
+    std::deque<CacheWrite> cache_writes;
+    bool cache_stopping;
+    std::thread cache_thread;
+};
+
+}
@@ -0,0 +1,136 @@
+#include "FetchMetrics.h"
+#include <iomanip>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+const char* kKindNames[kRequestKindCount] { "home API", "set JSON", "tile image", "other" };
+const char* kPhaseNames[kTransferPhaseCount] { "dns", "connect", "tls", "first byte", "download", "total" };
+
+size_t bucket_of(uint64_t value)
+{
+    size_t bucket { 0 };
+    while (value != 0)
+    {
+        ++bucket;
+        value >>= 1;
+    }
+    return bucket;
+}
+
+double milliseconds(double microseconds)
+{
+    return microseconds / 1000.0;
+}
+
+}
+
+void Log2Histogram::Add(uint64_t value)
+{
+    ++buckets[bucket_of(value)];
+    ++count;
+    sum += value;
+    if (value > max)
+    {
+        max = value;
+    }
+}
+
+uint64_t Log2Histogram::Count() const
+{
+    return count;
+}
+
+uint64_t Log2Histogram::Max() const
+{
+    return max;
+}
+
+double Log2Histogram::Mean() const
+{
+    return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+uint64_t Log2Histogram::Quantile(double quantile) const
+{
+    uint64_t rank = static_cast<uint64_t>(quantile * count);
+    uint64_t seen { 0 };
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket)
+    {
+        seen += buckets[bucket];
+        if (seen > rank)
+        {
+            uint64_t upper = bucket == 0 ? 0 : (bucket >= 64 ? max : (1ull << bucket) - 1);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+void FetchMetrics::RecordTransfer(RequestKind kind, const TransferTiming& timing)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    KindMetrics& metrics = kinds[static_cast<size_t>(kind)];
+    ++metrics.transfers;
+    if (timing.failed)
+    {
+        ++metrics.failures;
+    }
+    for (size_t phase = 0; phase < kTransferPhaseCount; ++phase)
+    {
+        metrics.phases[phase].Add(timing.phase_microseconds[phase]);
+    }
+    metrics.bytes.Add(timing.bytes);
+    metrics.wire_bytes += timing.bytes;
+    metrics.decoded_bytes += timing.decoded_bytes;
+}
+
+void FetchMetrics::RecordCacheHit(RequestKind kind)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++kinds[static_cast<size_t>(kind)].cache_hits;
+}
+
+void FetchMetrics::Report(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(1);
+    for (size_t kind = 0; kind < kRequestKindCount; ++kind)
+    {
+        const KindMetrics& metrics = kinds[kind];
+        if (metrics.transfers == 0 && metrics.cache_hits == 0)
+        {
+            continue;
+        }
+
+        out << "Fetch timing (" << kKindNames[kind] << "): "
+            << metrics.transfers << " transfers, "
+            << metrics.failures << " failed, "
+            << metrics.cache_hits << " served from cache, "
+            << metrics.bytes.Mean() << " mean bytes, "
+            << metrics.bytes.Quantile(0.9) << " p90 bytes, "
+            << metrics.wire_bytes << " bytes on the wire for "
+            << metrics.decoded_bytes << " decoded" << std::endl;
+        if (metrics.transfers == 0)
+        {
+            continue;
+        }
+        for (size_t phase = 0; phase < kTransferPhaseCount; ++phase)
+        {
+            const Log2Histogram& histogram = metrics.phases[phase];
+            out << "    " << std::left << std::setw(11) << kPhaseNames[phase] << std::right
+                << " mean " << milliseconds(histogram.Mean()) << "ms"
+                << ", p50 " << milliseconds(histogram.Quantile(0.5)) << "ms"
+                << ", p90 " << milliseconds(histogram.Quantile(0.9)) << "ms"
+                << ", p99 " << milliseconds(histogram.Quantile(0.99)) << "ms"
+                << ", max " << milliseconds(histogram.Max()) << "ms" << std::endl;
+        }
+    }
+    out.flags(flags);
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+namespace curlhelpers
+{
+
+enum class RequestKind
+{
+    HomeApi,
+    SetJson,
+    TileImage,
+    Other
+};
+
+const size_t kRequestKindCount { 4 };
+
+// Consecutive phases of a transfer; for a transfer that got a response they add up to Total.
+enum class TransferPhase
+{
+    NameLookup,
+    Connect,
+    TlsHandshake,
+    FirstByte,
+    Download,
+    Total
+};
+
+const size_t kTransferPhaseCount { 6 };
+
+struct TransferTiming
+{
+    std::array<uint64_t, kTransferPhaseCount> phase_microseconds {};
+    // body bytes as they crossed the wire, and after content decoding
+    uint64_t bytes { 0 };
+    uint64_t decoded_bytes { 0 };
+    bool failed { false };
+};
+
+// Bucket 0 counts zeros and bucket n counts values in [2^(n-1), 2^n), so
+// quantiles are reported as the upper bound of their bucket.
+class Log2Histogram
+{
+public:
+    void Add(uint64_t value);
+
+    uint64_t Count() const;
+    uint64_t Max() const;
+    double Mean() const;
+    uint64_t Quantile(double quantile) const;
+
+private:
+    std::array<uint64_t, 65> buckets {};
+    uint64_t count { 0 };
+    uint64_t sum { 0 };
+    uint64_t max { 0 };
+};
+
+// Per request kind histograms of where the time of every network transfer went.
+class FetchMetrics
+{
+public:
+    void RecordTransfer(RequestKind kind, const TransferTiming& timing);
+    void RecordCacheHit(RequestKind kind);
+
+    void Report(std::ostream& out) const;
+
+private:
+    struct KindMetrics
+    {
+        std::array<Log2Histogram, kTransferPhaseCount> phases;
+        Log2Histogram bytes;
+        uint64_t transfers { 0 };
+        uint64_t failures { 0 };
+        uint64_t cache_hits { 0 };
+        uint64_t wire_bytes { 0 };
+        uint64_t decoded_bytes { 0 };
+    };
+
+    mutable std::mutex mutex;
+    std::array<KindMetrics, kRequestKindCount> kinds;
+};
+
+}
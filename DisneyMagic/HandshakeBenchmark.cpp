@@ -0,0 +1,103 @@
+#include "HandshakeBenchmark.h"
+#include "CurlTransport.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+const long kConnectTimeoutMs { 5000 };
+const long kTotalTimeoutMs { 30000 };
+const long kStateTtlSeconds { 3600 };
+
+std::string benchmark_state_path()
+{
+    const char* temp = std::getenv("TMPDIR");
+    return std::string(temp != nullptr ? temp : "/tmp") + "/DisneyMagic-handshake-benchmark";
+}
+
+double phase_milliseconds(const TransferTiming& timing, TransferPhase phase)
+{
+    return timing.phase_microseconds[static_cast<size_t>(phase)] / 1000.0;
+}
+
+}
+
+void HandshakeBenchmark::Run(const std::vector<std::string>& urls, std::ostream& out)
+{
+    std::string state_path = benchmark_state_path();
+    std::remove(state_path.c_str());
+    std::vector<TransferTiming> cold = RunPass(urls, state_path);
+    std::vector<TransferTiming> resumed = RunPass(urls, state_path);
+    std::remove(state_path.c_str());
+
+    ReportPass("cold", urls, cold, out);
+    ReportPass("resumed", urls, resumed, out);
+}
+
+std::vector<TransferTiming> HandshakeBenchmark::RunPass(const std::vector<std::string>& urls, const std::string& state_path)
+{
+    CurlTransport transport(1, 1, kConnectTimeoutMs, kTotalTimeoutMs, std::make_unique<ResolverState>(state_path, kStateTtlSeconds));
+    std::vector<TransportRequest> requests(urls.size());
+    size_t outstanding { 0 };
+    for (size_t index = 0; index < urls.size(); ++index)
+    {
+        requests[index].result.url = urls[index];
+        if (transport.Start(requests[index]))
+        {
+            ++outstanding;
+        }
+    }
+
+    // a request that failed to start or never completed keeps a default result, which reads as a success
+    std::vector<bool> delivered(requests.size(), false);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kTotalTimeoutMs);
+    while (outstanding > 0 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::vector<TransportRequest*> completed;
+        transport.Perform(completed);
+        outstanding -= completed.size();
+        for (TransportRequest* request : completed)
+        {
+            delivered[request - requests.data()] = true;
+        }
+        if (outstanding > 0)
+        {
+            transport.Wait(100);
+        }
+    }
+
+    std::vector<TransferTiming> timings;
+    for (size_t index = 0; index < requests.size(); ++index)
+    {
+        TransferTiming timing = requests[index].timing;
+        timing.failed = !delivered[index] || !requests[index].result.Succeeded();
+        timings.push_back(timing);
+    }
+    return timings;
+}
+
+void HandshakeBenchmark::ReportPass(const char* name, const std::vector<std::string>& urls, const std::vector<TransferTiming>& timings, std::ostream& out)
+{
+    for (size_t index = 0; index < urls.size(); ++index)
+    {
+        const TransferTiming& timing = timings[index];
+        out << "Handshake benchmark (" << name << ") " << urls[index] << ": ";
+        if (timing.failed)
+        {
+            out << "failed" << std::endl;
+            continue;
+        }
+        out << "dns " << phase_milliseconds(timing, TransferPhase::NameLookup) << "ms, "
+            << "connect " << phase_milliseconds(timing, TransferPhase::Connect) << "ms, "
+            << "tls " << phase_milliseconds(timing, TransferPhase::TlsHandshake) << "ms, "
+            << "first byte " << phase_milliseconds(timing, TransferPhase::FirstByte) << "ms" << std::endl;
+    }
+}
+
+}
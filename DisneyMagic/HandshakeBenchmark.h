@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Transport.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace curlhelpers
+{
+
+// Compares connection setup on a cold launch with one that resumes from a
+// saved resolver state. The cold pass starts without a state file and writes
+// one, the resumed pass starts from it. Each pass gets a transport of its own,
+// so nothing carries over in memory between them. The state file lives in the
+// temporary directory and leaves the app's own state alone.
+class HandshakeBenchmark
+{
+public:
+    static void Run(const std::vector<std::string>& urls, std::ostream& out);
+
+private:
+    static std::vector<TransferTiming> RunPass(const std::vector<std::string>& urls, const std::string& state_path);
+    static void ReportPass(const char* name, const std::vector<std::string>& urls, const std::vector<TransferTiming>& timings, std::ostream& out);
+};
+
+}
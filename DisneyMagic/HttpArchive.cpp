@@ -0,0 +1,159 @@
+#include "HttpArchive.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+const char* kArchiveMagic = "DMARCHIVE 1";
+
+}
+
+// The file starts with a magic line, followed by one record per response:
+//   R <status> <header count> <url length> <body length>\n
+//   <url>\n
+//   <name>\t<value>\n            (once per header)
+//   <body>\n
+HttpArchive::HttpArchive(const std::string& path)
+    :   mutex(),
+        work(),
+        output(path, std::ios::binary | std::ios::trunc),
+        recorded(),
+        pending(),
+        stopping(false),
+        writer()
+{
+    if (!output)
+    {
+        throw std::runtime_error("Failed to create HTTP archive: " + path);
+    }
+    output << kArchiveMagic << '\n';
+    output.flush();
+    writer = std::thread(&HttpArchive::Run, this);
+}
+
+HttpArchive::~HttpArchive()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work.notify_one();
+    writer.join();
+}
+
+void HttpArchive::Record(ArchivedResponse response)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!recorded.insert(response.url).second)
+        {
+            return;
+        }
+    }
+
+    // the body was decoded on arrival, so the headers describing how it came over the wire would contradict it
+    auto describes_wire = [](const std::pair<std::string, std::string>& header)
+    {
+        return header.first == "content-encoding" || header.first == "content-length" || header.first == "transfer-encoding";
+    };
+    response.headers.erase(std::remove_if(response.headers.begin(), response.headers.end(), describes_wire), response.headers.end());
+    response.headers.emplace_back("content-length", std::to_string(response.body.size()));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(response));
+    }
+    work.notify_one();
+}
+
+void HttpArchive::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        work.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+        {
+            break;
+        }
+        ArchivedResponse response = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+
+        output << "R " << response.status_code << ' ' << response.headers.size() << ' '
+               << response.url.size() << ' ' << response.body.size() << '\n'
+               << response.url << '\n';
+        for (const auto& header : response.headers)
+        {
+            output << header.first << '\t' << header.second << '\n';
+        }
+        output.write(response.body.data(), response.body.size());
+        output << '\n';
+        output.flush();
+
+        lock.lock();
+    }
+}
+
+size_t HttpArchive::Size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return recorded.size();
+}
+
+std::vector<ArchivedResponse> HttpArchive::Load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open HTTP archive: " + path);
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != kArchiveMagic)
+    {
+        throw std::runtime_error("Not an HTTP archive: " + path);
+    }
+
+    // a record cut off at the end means the recording run stopped while writing it
+    std::vector<ArchivedResponse> responses;
+    char tag { 0 };
+    while (file >> tag)
+    {
+        ArchivedResponse response;
+        size_t header_count { 0 };
+        size_t url_length { 0 };
+        size_t body_length { 0 };
+        if (tag != 'R')
+        {
+            throw std::runtime_error("Corrupt HTTP archive: " + path);
+        }
+        if (!(file >> response.status_code >> header_count >> url_length >> body_length) || file.get() != '\n')
+        {
+            break;
+        }
+
+        response.url.resize(url_length);
+        file.read(&response.url[0], url_length);
+        file.get();
+        for (size_t index = 0; index < header_count && std::getline(file, line); ++index)
+        {
+            size_t tab = line.find('\t');
+            response.headers.emplace_back(line.substr(0, tab), tab == std::string::npos ? std::string() : line.substr(tab + 1));
+        }
+        response.body.resize(body_length);
+        file.read(&response.body[0], body_length);
+        if (!file || file.get() != '\n')
+        {
+            break;
+        }
+        responses.push_back(std::move(response));
+    }
+    return responses;
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace curlhelpers
+{
+
+struct ArchivedResponse
+{
+    std::string url;
+    long status_code { 0 };
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+// A file of HTTP responses, one per URL. Recording appends each URL's first
+// response as it is seen, so a run that is cut short still leaves a usable
+// archive. The file is written on a thread of its own, so recording never
+// blocks the caller on the disk. Bodies are stored decoded, with headers to
+// match. Load reads a whole archive back for replaying.
+class HttpArchive
+{
+public:
+    explicit HttpArchive(const std::string& path);
+    // Writes whatever is still queued.
+    ~HttpArchive();
+
+    HttpArchive(const HttpArchive&) = delete;
+    HttpArchive& operator=(const HttpArchive&) = delete;
+
+    void Record(ArchivedResponse response);
+    size_t Size() const;
+
+    static std::vector<ArchivedResponse> Load(const std::string& path);
+
+private:
+    void Run();
+
+    mutable std::mutex mutex;
+    std::condition_variable work;
+    std::ofstream output;
+    std::unordered_set<std::string> recorded;
+    std::deque<ArchivedResponse> pending;
+    bool stopping;
+    std::thread writer;
+};
+
+}
@@ -0,0 +1,147 @@
+#include "LocalTransport.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+namespace curlhelpers
+{
+
+LocalTransport::LocalTransport()
+    :   started(),
+        mutex(),
+        wakeup(),
+        woken(false)
+{}
+
+bool LocalTransport::Start(TransportRequest& request)
+{
+    started.push_back(&request);
+    return true;
+}
+
+void LocalTransport::Abort(TransportRequest& request)
+{
+    started.erase(std::remove(started.begin(), started.end(), &request), started.end());
+}
+
+void LocalTransport::Perform(std::vector<TransportRequest*>& completed)
+{
+    std::vector<TransportRequest*> finishing;
+    finishing.swap(started);
+    for (TransportRequest* request : finishing)
+    {
+        FetchResult& result = request->result;
+        if (Read(*request))
+        {
+            result.curl_code = CURLE_OK;
+            request->BodyReceived();
+        }
+        else
+        {
+            result.curl_code = CURLE_REMOTE_FILE_NOT_FOUND;
+        }
+        request->timing = TransferTiming();
+        request->timing.bytes = result.body.size();
+        request->timing.decoded_bytes = result.body.size();
+        completed.push_back(request);
+    }
+}
+
+void LocalTransport::Wait(long timeout_ms)
+{
+    if (!started.empty())
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    wakeup.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return woken; });
+    woken = false;
+}
+
+void LocalTransport::Wakeup()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        woken = true;
+    }
+    wakeup.notify_one();
+}
+
+void MemoryTransport::Add(ArchivedResponse response)
+{
+    std::string url = response.url;
+    responses[url] = std::move(response);
+}
+
+bool MemoryTransport::Read(TransportRequest& request)
+{
+    FetchResult& result = request.result;
+    auto found = responses.find(result.url);
+    if (found == responses.end())
+    {
+        return false;
+    }
+    result.status_code = found->second.status_code;
+    result.headers = found->second.headers;
+    request.ReserveBody(found->second.body.size());
+    result.body.assign(found->second.body);
+    return true;
+}
+
+DirectoryTransport::DirectoryTransport(const std::string& root)
+    :   root(root)
+{}
+
+bool DirectoryTransport::Read(TransportRequest& request)
+{
+    const std::string& url = request.result.url;
+    CURLU* parsed = curl_url();
+    if (parsed == nullptr)
+    {
+        return false;
+    }
+
+    std::string path;
+    char* host = nullptr;
+    char* url_path = nullptr;
+    char* query = nullptr;
+    if (curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+        curl_url_get(parsed, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+        curl_url_get(parsed, CURLUPART_PATH, &url_path, 0) == CURLUE_OK)
+    {
+        path = root + "/" + host + url_path;
+        if (curl_url_get(parsed, CURLUPART_QUERY, &query, 0) == CURLUE_OK)
+        {
+            path += "?" + std::string(query);
+        }
+    }
+    curl_free(host);
+    curl_free(url_path);
+    curl_free(query);
+    curl_url_cleanup(parsed);
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (path.empty() || !file)
+    {
+        return false;
+    }
+    std::streamoff size = file.tellg();
+    file.seekg(0);
+    if (size < 0 || !file)
+    {
+        return false;
+    }
+    FetchResult& result = request.result;
+    request.ReserveBody(static_cast<size_t>(size));
+    // read straight into the reserved buffer rather than through a temporary
+    result.body.resize(static_cast<size_t>(size));
+    if (size > 0 && !file.read(&result.body[0], size))
+    {
+        result.body.clear();
+        return false;
+    }
+    result.status_code = 200;
+    return true;
+}
+
+}
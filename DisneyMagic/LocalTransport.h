@@ -0,0 +1,68 @@
+#pragma once
+
+#include "HttpArchive.h"
+#include "Transport.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace curlhelpers
+{
+
+// Completes every request on the next Perform from a source in this process.
+// A URL the source does not have fails with CURLE_REMOTE_FILE_NOT_FOUND.
+class LocalTransport : public Transport
+{
+public:
+    LocalTransport();
+
+    bool Start(TransportRequest& request) override;
+    void Abort(TransportRequest& request) override;
+    void Perform(std::vector<TransportRequest*>& completed) override;
+    void Wait(long timeout_ms) override;
+    void Wakeup() override;
+
+protected:
+    // Fills in the status, headers and body for the request's URL, or returns
+    // false if there are none. The body is reserved with ReserveBody once the
+    // headers are in, as a network transport would.
+    virtual bool Read(TransportRequest& request) = 0;
+
+private:
+    std::vector<TransportRequest*> started;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool woken;
+};
+
+// Serves responses held in memory, for example those loaded from an HttpArchive.
+// Responses must all be added before the transport is handed to an engine.
+class MemoryTransport : public LocalTransport
+{
+public:
+    void Add(ArchivedResponse response);
+
+protected:
+    bool Read(TransportRequest& request) override;
+
+private:
+    std::unordered_map<std::string, ArchivedResponse> responses;
+};
+
+// Serves files from a directory laid out like the URLs it mirrors:
+// https://host/a/b.json is read from <root>/host/a/b.json.
+class DirectoryTransport : public LocalTransport
+{
+public:
+    explicit DirectoryTransport(const std::string& root);
+
+protected:
+    bool Read(TransportRequest& request) override;
+
+private:
+    std::string root;
+};
+
+}
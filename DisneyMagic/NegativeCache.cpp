@@ -0,0 +1,96 @@
+#include "NegativeCache.h"
+#include <iterator>
+
+namespace curlhelpers
+{
+
+namespace
+{
+
+// Expired failures are only swept out once a table grows past this size.
+const size_t kMaxFailures { 1024 };
+
+}
+
+NegativeCache::NegativeCache(const NegativeCacheTtls& ttls)
+    :   ttls(ttls),
+        by_url(),
+        by_host()
+{}
+
+void NegativeCache::Record(const FetchResult& result, const std::string& host)
+{
+    if (result.Succeeded())
+    {
+        by_url.erase(result.url);
+        by_host.erase(host);
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (result.curl_code == CURLE_COULDNT_RESOLVE_HOST)
+    {
+        if (ttls.name_lookup_ms > 0)
+        {
+            Remember(by_host, host, result, now + std::chrono::milliseconds(ttls.name_lookup_ms));
+        }
+        return;
+    }
+
+    long ttl_ms { 0 };
+    if (result.curl_code == CURLE_OPERATION_TIMEDOUT)
+    {
+        ttl_ms = ttls.timeout_ms;
+    }
+    else if (result.curl_code == CURLE_OK && (result.status_code == 404 || result.status_code == 410))
+    {
+        ttl_ms = ttls.not_found_ms;
+    }
+    else if (result.curl_code == CURLE_OK && result.status_code >= 500)
+    {
+        ttl_ms = ttls.server_error_ms;
+    }
+    if (ttl_ms > 0)
+    {
+        Remember(by_url, result.url, result, now + std::chrono::milliseconds(ttl_ms));
+    }
+}
+
+bool NegativeCache::Lookup(const std::string& url, const std::string& host, FetchResult& result)
+{
+    Clock::time_point now = Clock::now();
+    return Find(by_host, host, now, result) || Find(by_url, url, now, result);
+}
+
+bool NegativeCache::Find(std::unordered_map<std::string, Failure>& failures, const std::string& key, Clock::time_point now, FetchResult& result)
+{
+    auto found = failures.find(key);
+    if (found == failures.end())
+    {
+        return false;
+    }
+    if (found->second.expires_at <= now)
+    {
+        failures.erase(found);
+        return false;
+    }
+    result.status_code = found->second.status_code;
+    result.curl_code = found->second.curl_code;
+    result.error = found->second.error;
+    return true;
+}
+
+void NegativeCache::Remember(std::unordered_map<std::string, Failure>& failures, const std::string& key, const FetchResult& result, Clock::time_point expires_at)
+{
+    if (failures.size() >= kMaxFailures)
+    {
+        Clock::time_point now = Clock::now();
+        for (auto it = failures.begin(); it != failures.end();)
+        {
+            it = it->second.expires_at <= now ? failures.erase(it) : std::next(it);
+        }
+    }
+    failures[key] = Failure { result.status_code, result.curl_code, result.error, expires_at };
+}
+
+}
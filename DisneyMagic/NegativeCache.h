@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Transport.h"
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+namespace curlhelpers
+{
+
+// How long each class of failure is remembered; zero disables the class.
+struct NegativeCacheTtls
+{
+    // 404 and 410 responses
+    long not_found_ms { 300000 };
+    // host names that did not resolve, remembered for the whole host
+    long name_lookup_ms { 30000 };
+    long timeout_ms { 15000 };
+    // 5xx responses, kept short so a degraded CDN is retried once it recovers
+    long server_error_ms { 10000 };
+};
+
+// Remembers recent failures that are likely to repeat, so that asking for the
+// same dead URL again fails at once instead of costing another transfer and
+// its retries. Used from the fetch engine's I/O thread only.
+class NegativeCache
+{
+public:
+    explicit NegativeCache(const NegativeCacheTtls& ttls);
+
+    // Remembers a failed result if its failure belongs to one of the classes.
+    // A success forgets earlier failures for the URL and its host.
+    void Record(const FetchResult& result, const std::string& host);
+
+    // While a failure for the URL or its host is remembered, copies it into
+    // result and returns true.
+    bool Lookup(const std::string& url, const std::string& host, FetchResult& result);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Failure
+    {
+        long status_code;
+        CURLcode curl_code;
+        std::string error;
+        Clock::time_point expires_at;
+    };
+
+    static bool Find(std::unordered_map<std::string, Failure>& failures, const std::string& key, Clock::time_point now, FetchResult& result);
+    static void Remember(std::unordered_map<std::string, Failure>& failures, const std::string& key, const FetchResult& result, Clock::time_point expires_at);
+
+    NegativeCacheTtls ttls;
+    std::unordered_map<std::string, Failure> by_url;
+    std::unordered_map<std::string, Failure> by_host;
+};
+
+}
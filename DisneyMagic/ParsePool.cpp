@@ -0,0 +1,87 @@
+#include "ParsePool.h"
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+namespace disneymagic
+{
+
+namespace
+{
+
+// Beyond this many workers parsing stops being the bottleneck long before the network does.
+const size_t kMaxParseThreads { 4 };
+// The UI thread and the fetch engine's I/O thread each keep a core busy.
+const size_t kReservedCores { 2 };
+
+}
+
+ParsePool::ParsePool(size_t thread_count)
+    :   mutex(),
+        job_queued(),
+        jobs(),
+        stopping(false),
+        threads()
+{
+    if (thread_count == 0)
+    {
+        size_t cores = std::thread::hardware_concurrency();
+        thread_count = std::min(cores > kReservedCores ? cores - kReservedCores : 1, kMaxParseThreads);
+    }
+    for (size_t index = 0; index < thread_count; ++index)
+    {
+        threads.emplace_back(&ParsePool::Work, this);
+    }
+}
+
+ParsePool::~ParsePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_queued.notify_all();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void ParsePool::ParseSet(std::string json, std::promise<Catalog> catalog)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(Job { std::move(json), std::move(catalog) });
+    }
+    job_queued.notify_one();
+}
+
+void ParsePool::Work()
+{
+    CatalogExtractor extractor;
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_queued.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        try
+        {
+            job.catalog.set_value(extractor.ExtractSet(std::move(job.json)));
+        }
+        catch(...)
+        {
+            job.catalog.set_exception(std::current_exception());
+        }
+    }
+}
+
+}
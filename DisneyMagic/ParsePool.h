@@ -0,0 +1,49 @@
+#pragma once
+
+#include "CatalogExtractor.h"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace disneymagic
+{
+
+// Extracts set documents on worker threads, so the UI thread only builds rows
+// from finished catalogs. Each worker has a CatalogExtractor of its own and
+// the workers share nothing but the queue. ParseSet only queues the document,
+// so it may be called from any thread, the fetch engine's I/O thread included.
+class ParsePool
+{
+public:
+    // Zero picks a thread per core the UI and I/O threads leave free, at least one.
+    explicit ParsePool(size_t thread_count = 0);
+    // Documents still queued are dropped, which breaks their promises.
+    ~ParsePool();
+
+    ParsePool(const ParsePool&) = delete;
+    ParsePool& operator=(const ParsePool&) = delete;
+
+    // Fulfils the promise with the extracted set, or with the exception extraction threw.
+    void ParseSet(std::string json, std::promise<Catalog> catalog);
+
+private:
+    struct Job
+    {
+        std::string json;
+        std::promise<Catalog> catalog;
+    };
+
+    void Work();
+
+    std::mutex mutex;
+    std::condition_variable job_queued;
+    std::deque<Job> jobs;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
+
+}
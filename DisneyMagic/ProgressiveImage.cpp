@@ -0,0 +1,169 @@
+#include "ProgressiveImage.h"
+
+namespace disneymagic
+{
+
+namespace
+{
+
+const unsigned char kMarkerPrefix { 0xFF };
+const unsigned char kStartOfImage { 0xD8 };
+const unsigned char kEndOfImage { 0xD9 };
+const unsigned char kStartOfScan { 0xDA };
+const unsigned char kProgressiveFrame { 0xC2 };
+
+unsigned char byte_at(const std::string& data, size_t index)
+{
+    return static_cast<unsigned char>(data[index]);
+}
+
+// Markers that stand alone without a length field.
+bool is_standalone_marker(unsigned char marker)
+{
+    return marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7);
+}
+
+}
+
+ProgressiveImage::ProgressiveImage()
+    :   offset(0),
+        in_scan(false),
+        progressive(false),
+        finished(false),
+        mutex(),
+        preview(),
+        preview_ready(false)
+{}
+
+// A retried transfer starts again from the first byte. It carries the same
+// image, so parsing simply waits until it has caught up with the offset.
+void ProgressiveImage::Append(const std::string& received)
+{
+    if (finished)
+    {
+        return;
+    }
+
+    if (offset == 0)
+    {
+        if (received.size() < 2)
+        {
+            return;
+        }
+        if (byte_at(received, 0) != kMarkerPrefix || byte_at(received, 1) != kStartOfImage)
+        {
+            finished = true;
+            return;
+        }
+        offset = 2;
+    }
+
+    while (!finished && (in_scan ? ParseScanData(received) : ParseSegment(received)))
+    {
+    }
+}
+
+bool ProgressiveImage::TakePreview(std::string& preview)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!preview_ready)
+    {
+        return false;
+    }
+    preview.swap(this->preview);
+    this->preview.clear();
+    preview_ready = false;
+    return true;
+}
+
+bool ProgressiveImage::ParseSegment(const std::string& received)
+{
+    if (offset + 2 > received.size())
+    {
+        return false;
+    }
+    if (byte_at(received, offset) != kMarkerPrefix)
+    {
+        // not a JPEG we understand, leave it to the full decode
+        finished = true;
+        return false;
+    }
+
+    unsigned char marker = byte_at(received, offset + 1);
+    if (marker == kMarkerPrefix)
+    {
+        ++offset;
+        return true;
+    }
+    if (marker == kEndOfImage)
+    {
+        finished = true;
+        return false;
+    }
+    if (is_standalone_marker(marker))
+    {
+        offset += 2;
+        return true;
+    }
+
+    if (offset + 4 > received.size())
+    {
+        return false;
+    }
+    size_t length = (byte_at(received, offset + 2) << 8) | byte_at(received, offset + 3);
+    if (offset + 2 + length > received.size())
+    {
+        return false;
+    }
+
+    if (marker == kProgressiveFrame)
+    {
+        progressive = true;
+    }
+    else if (marker == kStartOfScan)
+    {
+        in_scan = true;
+    }
+    offset += 2 + length;
+    return true;
+}
+
+bool ProgressiveImage::ParseScanData(const std::string& received)
+{
+    for (; offset + 1 < received.size(); ++offset)
+    {
+        if (byte_at(received, offset) != kMarkerPrefix)
+        {
+            continue;
+        }
+
+        unsigned char next = byte_at(received, offset + 1);
+        if (next == 0x00 || is_standalone_marker(next))
+        {
+            // stuffed byte or restart marker inside the entropy-coded data
+            ++offset;
+            continue;
+        }
+        if (next == kMarkerPrefix)
+        {
+            continue;
+        }
+
+        // any other marker ends the scan
+        in_scan = false;
+
+        // after the last scan the full image is moments away, so a preview would be wasted
+        if (progressive && next != kEndOfImage)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            preview.assign(received, 0, offset);
+            preview.push_back(static_cast<char>(kMarkerPrefix));
+            preview.push_back(static_cast<char>(kEndOfImage));
+            preview_ready = true;
+        }
+        return true;
+    }
+    return false;
+}
+
+}
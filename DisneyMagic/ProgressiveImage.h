@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+namespace disneymagic
+{
+
+// Follows a JPEG as it downloads and cuts a decodable preview after every
+// complete scan of a progressive image. The preview is the data received up to
+// the end of the latest scan with an end-of-image marker appended, so the
+// decoder fills in the missing refinement with zeros and yields a coarse image.
+// Append is called on the fetch engine's I/O thread, TakePreview on the UI thread.
+class ProgressiveImage
+{
+public:
+    ProgressiveImage();
+
+    ProgressiveImage(const ProgressiveImage&) = delete;
+    ProgressiveImage& operator=(const ProgressiveImage&) = delete;
+
+    void Append(const std::string& received);
+
+    // Returns true and the newest preview if one was cut since the last call.
+    bool TakePreview(std::string& preview);
+
+private:
+    bool ParseSegment(const std::string& received);
+    bool ParseScanData(const std::string& received);
+
+    size_t offset;
+    bool in_scan;
+    bool progressive;
+    bool finished;
+    std::mutex mutex;
+    std::string preview;
+    bool preview_ready;
+};
+
+}
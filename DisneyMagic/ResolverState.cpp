@@ -0,0 +1,142 @@
+#include "ResolverState.h"
+#include "DiskCache.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace curlhelpers
+{
+
+ResolverState::ResolverState(const std::string& path, long ttl_seconds)
+    :   path(path),
+        ttl_seconds(ttl_seconds),
+        entries(),
+        dirty(false)
+{
+    Load();
+}
+
+ResolverState::~ResolverState()
+{
+    if (dirty)
+    {
+        Save();
+    }
+}
+
+curl_slist* ResolverState::AppendResolveEntry(const std::string& host, long port, curl_slist* list)
+{
+    std::string key = host + ":" + std::to_string(port);
+    auto found = entries.find(key);
+    if (found == entries.end())
+    {
+        return list;
+    }
+
+    Entry& entry = found->second;
+    if (entry.forgotten)
+    {
+        // entries given to curl with CURLOPT_RESOLVE never expire on their own
+        list = curl_slist_append(list, ("-" + key).c_str());
+        entries.erase(found);
+        return list;
+    }
+    if (entry.pinned && !entry.applied)
+    {
+        entry.applied = true;
+        bool ipv6 = entry.address.find(':') != std::string::npos;
+        list = curl_slist_append(list, (key + ":" + (ipv6 ? "[" + entry.address + "]" : entry.address)).c_str());
+    }
+    return list;
+}
+
+void ResolverState::Record(const std::string& host, long port, const std::string& address)
+{
+    if (address.empty())
+    {
+        return;
+    }
+    std::string key = host + ":" + std::to_string(port);
+    auto found = entries.find(key);
+    if (found != entries.end() && found->second.pinned)
+    {
+        return;
+    }
+
+    bool changed = found == entries.end() || found->second.address != address;
+    entries[key] = Entry { address, std::time(nullptr) + ttl_seconds, false, false, false };
+    dirty = true;
+    // a new host is worth saving right away in case this launch does not exit cleanly
+    if (changed)
+    {
+        Save();
+    }
+}
+
+void ResolverState::Forget(const std::string& host, long port)
+{
+    auto found = entries.find(host + ":" + std::to_string(port));
+    if (found == entries.end())
+    {
+        return;
+    }
+    if (found->second.applied)
+    {
+        found->second.forgotten = true;
+    }
+    else
+    {
+        entries.erase(found);
+    }
+    dirty = true;
+}
+
+std::string ResolverState::DefaultPath()
+{
+    return DiskCache::DefaultDirectory() + "/resolved-hosts";
+}
+
+// Lines are: host:port, address, expires-at (tab separated)
+void ResolverState::Load()
+{
+    std::ifstream file(path);
+    std::time_t now = std::time(nullptr);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string key;
+        std::string address;
+        std::time_t expires_at { 0 };
+        if (std::getline(fields, key, '\t') && std::getline(fields, address, '\t') && (fields >> expires_at) && expires_at > now)
+        {
+            entries[key] = Entry { address, expires_at, true, false, false };
+        }
+    }
+}
+
+void ResolverState::Save()
+{
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        for (const auto& entry : entries)
+        {
+            if (!entry.second.forgotten)
+            {
+                file << entry.first << '\t' << entry.second.address << '\t' << entry.second.expires_at << '\n';
+            }
+        }
+        if (!file)
+        {
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) == 0)
+    {
+        dirty = false;
+    }
+}
+
+}
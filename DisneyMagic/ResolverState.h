@@ -0,0 +1,58 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+
+namespace curlhelpers
+{
+
+// Keeps the addresses hosts resolved to in a small state file, so the next
+// launch hands them to curl with CURLOPT_RESOLVE and connects without waiting
+// on DNS. curl does not report DNS TTLs, so each address is trusted for a fixed
+// time from when it was resolved. Used from the transport's thread only.
+class ResolverState
+{
+public:
+    ResolverState(const std::string& path, long ttl_seconds);
+    ~ResolverState();
+
+    ResolverState(const ResolverState&) = delete;
+    ResolverState& operator=(const ResolverState&) = delete;
+
+    // Appends the CURLOPT_RESOLVE entry a request to host:port needs, if any:
+    // the saved address while it is trusted, or its removal after it failed.
+    curl_slist* AppendResolveEntry(const std::string& host, long port, curl_slist* list);
+
+    // Saves an address curl resolved; addresses loaded from the file are kept until they expire.
+    void Record(const std::string& host, long port, const std::string& address);
+    // Drops a saved address after connecting to it failed.
+    void Forget(const std::string& host, long port);
+
+    static std::string DefaultPath();
+
+private:
+    struct Entry
+    {
+        std::string address;
+        std::time_t expires_at;
+        // loaded from the file and handed to curl rather than resolved this launch
+        bool pinned;
+        // curl has been given the pinned address and keeps it in its DNS cache
+        bool applied;
+        // the pinned address failed and curl still has to be told to drop it
+        bool forgotten;
+    };
+
+    void Load();
+    void Save();
+
+    std::string path;
+    long ttl_seconds;
+    // keyed by host:port
+    std::unordered_map<std::string, Entry> entries;
+    bool dirty;
+};
+
+}
@@ -0,0 +1,76 @@
+#include "SetResolver.h"
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+namespace disneymagic
+{
+
+SetResolver::SetResolver(std::shared_ptr<ParsePool> parse_pool)
+    :   parse_pool(std::move(parse_pool)),
+        pending()
+{}
+
+void SetResolver::ResolveAll(const std::vector<CatalogContainer>& containers, size_t visible_row_count)
+{
+    for (size_t row = 0; row < containers.size(); ++row)
+    {
+        std::string ref_id(containers[row].ref_id);
+        if (ref_id.empty() || pending.count(ref_id) > 0)
+        {
+            continue;
+        }
+
+        curlhelpers::FetchPriority priority = curlhelpers::FetchPriority::Prefetch;
+        if (row < visible_row_count)
+        {
+            priority = curlhelpers::FetchPriority::Visible;
+        }
+        else if (row == visible_row_count)
+        {
+            priority = curlhelpers::FetchPriority::NearViewport;
+        }
+
+        PendingSet& pending_set = pending[ref_id];
+        pending_set.catalog = Submit(ref_id, priority, pending_set.request);
+    }
+}
+
+std::future<Catalog> SetResolver::Take(const std::string& ref_id, curlhelpers::RequestId& request)
+{
+    auto found = pending.find(ref_id);
+    if (found == pending.end() || !found->second.catalog.valid())
+    {
+        // a set shared by several rows is fetched once; the engine coalesces the later requests
+        return Submit(ref_id, curlhelpers::FetchPriority::Visible, request);
+    }
+    request = found->second.request;
+    return std::move(found->second.catalog);
+}
+
+std::future<Catalog> SetResolver::Submit(const std::string& ref_id, curlhelpers::FetchPriority priority, curlhelpers::RequestId& request)
+{
+    auto catalog = std::make_shared<std::promise<Catalog>>();
+    std::future<Catalog> parsed = catalog->get_future();
+    std::shared_ptr<ParsePool> pool = parse_pool;
+    request = curlhelpers::FetchEngine::Instance().Submit(SetUrl(ref_id), curlhelpers::RequestKind::SetJson, priority,
+        [pool, catalog](curlhelpers::FetchResult& result)
+        {
+            if (result.Succeeded())
+            {
+                pool->ParseSet(std::move(result.body), std::move(*catalog));
+            }
+            else
+            {
+                catalog->set_exception(std::make_exception_ptr(std::runtime_error(result.error)));
+            }
+        });
+    return parsed;
+}
+
+std::string SetResolver::SetUrl(const std::string& ref_id)
+{
+    return "https://cd-static.bamgrid.com/dp-117731241344/sets/" + ref_id + ".json";
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "CatalogExtractor.h"
+#include "CurlHelpers.h"
+#include "ParsePool.h"
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace disneymagic
+{
+
+// Fetches the set documents of every SetRef container in the home API as soon
+// as it is parsed, rather than as each row is built, so rows scrolled into
+// view find their items already downloaded. Each document goes from the fetch
+// engine straight to the parse pool, so what a row receives is the extracted
+// catalog. Used from the UI thread only.
+class SetResolver
+{
+public:
+    // The fetch callbacks share the pool, since they can outlive the resolver.
+    explicit SetResolver(std::shared_ptr<ParsePool> parse_pool);
+
+    // Submits every set in row order. The first visible_row_count rows are
+    // fetched as visible, the next one as near the viewport and the rest as
+    // prefetches, which the engine starts first come first served.
+    void ResolveAll(const std::vector<CatalogContainer>& containers, size_t visible_row_count);
+
+    // Hands a set's fetch over to its container, submitting it now if
+    // ResolveAll did not.
+    std::future<Catalog> Take(const std::string& ref_id, curlhelpers::RequestId& request);
+
+    static std::string SetUrl(const std::string& ref_id);
+
+private:
+    struct PendingSet
+    {
+        std::future<Catalog> catalog;
+        curlhelpers::RequestId request;
+    };
+
+    std::future<Catalog> Submit(const std::string& ref_id, curlhelpers::FetchPriority priority, curlhelpers::RequestId& request);
+
+    std::shared_ptr<ParsePool> parse_pool;
+    std::unordered_map<std::string, PendingSet> pending;
+};
+
+}
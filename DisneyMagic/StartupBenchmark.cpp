@@ -0,0 +1,98 @@
+#include "StartupBenchmark.h"
+#include <algorithm>
+
+namespace disneymagic
+{
+
+StartupBenchmark::StartupBenchmark(double timeout_seconds)
+    :   started_at(Clock::now()),
+        timeout_seconds(timeout_seconds),
+        first_row_seconds(-1),
+        full_viewport_seconds(-1),
+        failed_tiles(0)
+{}
+
+bool StartupBenchmark::Update(
+    const std::vector<std::unique_ptr<Container>>& containers,
+    size_t first_container_index,
+    const std::vector<int>& first_item_index_per_row,
+    size_t row_count,
+    size_t tile_count)
+{
+    double elapsed = std::chrono::duration<double>(Clock::now() - started_at).count();
+
+    bool viewport_complete { true };
+    size_t failed { 0 };
+    size_t last_row = std::min(containers.size(), first_container_index + row_count);
+    for (size_t container_index = first_container_index; container_index < last_row; ++container_index)
+    {
+        bool row_complete = RowComplete(*containers[container_index], first_item_index_per_row[container_index], tile_count, failed);
+        if (container_index == first_container_index && row_complete && first_row_seconds < 0)
+        {
+            first_row_seconds = elapsed;
+        }
+        viewport_complete = viewport_complete && row_complete;
+    }
+
+    if (full_viewport_seconds >= 0)
+    {
+        return true;
+    }
+    failed_tiles = failed;
+    if (viewport_complete)
+    {
+        full_viewport_seconds = elapsed;
+    }
+    return full_viewport_seconds >= 0 || elapsed > timeout_seconds;
+}
+
+void StartupBenchmark::Report(std::ostream& out) const
+{
+    out << "Startup benchmark: ";
+    if (first_row_seconds >= 0)
+    {
+        out << "first row " << first_row_seconds * 1000 << "ms";
+    }
+    else
+    {
+        out << "first row incomplete";
+    }
+    if (full_viewport_seconds >= 0)
+    {
+        out << ", full viewport " << full_viewport_seconds * 1000 << "ms";
+    }
+    else
+    {
+        out << ", full viewport incomplete after " << timeout_seconds << "s";
+    }
+    if (failed_tiles > 0)
+    {
+        out << ", " << failed_tiles << " tiles failed";
+    }
+    out << std::endl;
+}
+
+bool StartupBenchmark::RowComplete(Container& container, size_t first_item, size_t tile_count, size_t& failed_tiles)
+{
+    if (!container.IsPopulated())
+    {
+        return false;
+    }
+    bool complete { true };
+    size_t last_item = std::min(container.GetItemCount(), first_item + tile_count);
+    for (size_t index = first_item; index < last_item; ++index)
+    {
+        ContainerItem& item = container.GetItem(index);
+        if (item.HasFailed())
+        {
+            ++failed_tiles;
+        }
+        else if (!item.HasImage())
+        {
+            complete = false;
+        }
+    }
+    return complete;
+}
+
+}
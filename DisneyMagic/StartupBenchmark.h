@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Container.h"
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace disneymagic
+{
+
+// Measures how long the home screen takes to fill in. The first row is done
+// when every tile on screen in the top row shows an image, the viewport when
+// every tile on screen does. Rows whose set document failed and tiles whose
+// image failed count as done; the failed tiles are reported separately.
+class StartupBenchmark
+{
+public:
+    explicit StartupBenchmark(double timeout_seconds);
+
+    // Called once per frame; returns true once the viewport is complete or the timeout has passed.
+    bool Update(
+        const std::vector<std::unique_ptr<Container>>& containers,
+        size_t first_container_index,
+        const std::vector<int>& first_item_index_per_row,
+        size_t row_count,
+        size_t tile_count);
+
+    void Report(std::ostream& out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Adds the row's failed tiles to failed_tiles.
+    static bool RowComplete(Container& container, size_t first_item, size_t tile_count, size_t& failed_tiles);
+
+    Clock::time_point started_at;
+    double timeout_seconds;
+    double first_row_seconds;
+    double full_viewport_seconds;
+    // failed tiles on screen when the viewport completed or the timeout passed
+    size_t failed_tiles;
+};
+
+}
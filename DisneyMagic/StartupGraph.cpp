@@ -0,0 +1,140 @@
+#include "StartupGraph.h"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace disneymagic
+{
+
+StartupGraph::StartupGraph()
+    :   phases(),
+        started_at(Clock::now()),
+        mutex(),
+        phase_done(),
+        failure()
+{}
+
+void StartupGraph::Add(const std::string& name, const std::vector<std::string>& dependencies, Affinity affinity, std::function<void()> run)
+{
+    // phases can only depend on phases added before them, which rules out cycles
+    Phase phase { name, {}, affinity, std::move(run), State::Waiting, 0, 0 };
+    for (const std::string& dependency : dependencies)
+    {
+        auto found = std::find_if(phases.begin(), phases.end(), [&dependency](const Phase& added) { return added.name == dependency; });
+        if (found == phases.end())
+        {
+            throw std::runtime_error("Unknown startup phase: " + dependency);
+        }
+        phase.dependencies.push_back(static_cast<size_t>(found - phases.begin()));
+    }
+    phases.push_back(std::move(phase));
+}
+
+void StartupGraph::Run()
+{
+    started_at = Clock::now();
+    std::vector<std::thread> threads;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        Phase* main_thread_phase = nullptr;
+        bool running { false };
+        for (Phase& phase : phases)
+        {
+            if (phase.state == State::Running)
+            {
+                running = true;
+            }
+            if (phase.state != State::Waiting || failure || !Ready(phase))
+            {
+                continue;
+            }
+            if (phase.affinity == Affinity::AnyThread)
+            {
+                phase.state = State::Running;
+                running = true;
+                threads.emplace_back([this, &phase] { RunPhase(phase); });
+            }
+            else if (main_thread_phase == nullptr)
+            {
+                main_thread_phase = &phase;
+            }
+        }
+
+        if (main_thread_phase != nullptr)
+        {
+            main_thread_phase->state = State::Running;
+            lock.unlock();
+            RunPhase(*main_thread_phase);
+            lock.lock();
+            continue;
+        }
+        if (!running)
+        {
+            break;
+        }
+        phase_done.wait(lock);
+    }
+    lock.unlock();
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+}
+
+void StartupGraph::Report(std::ostream& out) const
+{
+    for (const Phase& phase : phases)
+    {
+        out << "Startup phase " << phase.name << ": ";
+        if (phase.state == State::Done)
+        {
+            out << phase.started_seconds * 1000 << "ms to " << phase.finished_seconds * 1000 << "ms" << std::endl;
+        }
+        else
+        {
+            out << "not run" << std::endl;
+        }
+    }
+}
+
+bool StartupGraph::Ready(const Phase& phase) const
+{
+    return std::all_of(phase.dependencies.begin(), phase.dependencies.end(),
+        [this](size_t dependency) { return phases[dependency].state == State::Done; });
+}
+
+void StartupGraph::RunPhase(Phase& phase)
+{
+    double started_seconds = std::chrono::duration<double>(Clock::now() - started_at).count();
+    std::exception_ptr error;
+    try
+    {
+        phase.run();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    double finished_seconds = std::chrono::duration<double>(Clock::now() - started_at).count();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        phase.started_seconds = started_seconds;
+        phase.finished_seconds = finished_seconds;
+        phase.state = State::Done;
+        if (error && !failure)
+        {
+            failure = error;
+        }
+    }
+    phase_done.notify_all();
+}
+
+}
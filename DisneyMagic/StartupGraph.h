@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace disneymagic
+{
+
+// Runs the startup phases as a dependency graph: each phase starts as soon as
+// the phases it depends on are done, so network, disk and display setup
+// overlap. Phases run on threads of their own unless they have to stay on the
+// main thread, as window and GPU setup do.
+class StartupGraph
+{
+public:
+    enum class Affinity
+    {
+        AnyThread,
+        MainThread
+    };
+
+    StartupGraph();
+
+    StartupGraph(const StartupGraph&) = delete;
+    StartupGraph& operator=(const StartupGraph&) = delete;
+
+    void Add(const std::string& name, const std::vector<std::string>& dependencies, Affinity affinity, std::function<void()> run);
+
+    // Runs every phase, calling the main thread phases on the calling thread.
+    // After a phase throws no new phases start, and once the running ones are
+    // done the exception is rethrown.
+    void Run();
+
+    void Report(std::ostream& out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State
+    {
+        Waiting,
+        Running,
+        Done
+    };
+
+    struct Phase
+    {
+        std::string name;
+        std::vector<size_t> dependencies;
+        Affinity affinity;
+        std::function<void()> run;
+        State state;
+        double started_seconds;
+        double finished_seconds;
+    };
+
+    bool Ready(const Phase& phase) const;
+    void RunPhase(Phase& phase);
+
+    std::vector<Phase> phases;
+    Clock::time_point started_at;
+    std::mutex mutex;
+    std::condition_variable phase_done;
+    std::exception_ptr failure;
+};
+
+}
@@ -0,0 +1,63 @@
+#include "Transport.h"
+#include <cstdio>
+
+namespace curlhelpers
+{
+
+bool FetchResult::Succeeded() const
+{
+    return curl_code == CURLE_OK && error.empty();
+}
+
+const std::string* FetchResult::Header(const std::string& name) const
+{
+    for (const auto& header : headers)
+    {
+        if (header.first == name)
+        {
+            return &header.second;
+        }
+    }
+    return nullptr;
+}
+
+void Transport::Preconnect(const std::string&)
+{}
+
+bool FetchResult::IsPartial() const
+{
+    if (status_code != 206 || Header("content-range") == nullptr)
+    {
+        return false;
+    }
+    uint64_t last { 0 };
+    uint64_t total { 0 };
+    return !ContentRange(last, total) || last + 1 < total;
+}
+
+bool FetchResult::ContentRange(uint64_t& last, uint64_t& total) const
+{
+    const std::string* content_range = Header("content-range");
+    if (status_code != 206 || content_range == nullptr)
+    {
+        return false;
+    }
+    // bytes <first>-<last>/<total>, where the total may be * when unknown
+    unsigned long long first_byte { 0 };
+    unsigned long long last_byte { 0 };
+    unsigned long long total_size { 0 };
+    if (std::sscanf(content_range->c_str(), "bytes %llu-%llu/%llu", &first_byte, &last_byte, &total_size) != 3)
+    {
+        return false;
+    }
+    last = last_byte;
+    total = total_size;
+    return true;
+}
+
+PoolStats Transport::GetPoolStats() const
+{
+    return PoolStats();
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ConnectionPool.h"
+#include "FetchMetrics.h"
+#include <curl/curl.h>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace curlhelpers
+{
+
+struct FetchResult
+{
+    std::string url;
+    std::string body;
+    // header names are lower-cased
+    std::vector<std::pair<std::string, std::string>> headers;
+    long status_code { 0 };
+    CURLcode curl_code { CURLE_OK };
+    std::string error;
+    bool from_cache { false };
+    bool cancelled { false };
+
+    bool Succeeded() const;
+    const std::string* Header(const std::string& name) const;
+    // True for a 206 response whose range stops short of the end of the resource.
+    bool IsPartial() const;
+    // Reads the last byte and the total size from the Content-Range of a 206
+    // response; false if there is none or the total is not known.
+    bool ContentRange(uint64_t& last, uint64_t& total) const;
+};
+
+// One attempt at a request as a transport sees it. The fetch engine sets the
+// URL in result and the extra request headers; the transport fills in the
+// rest of result and the timing.
+struct TransportRequest
+{
+    virtual ~TransportRequest() = default;
+
+    // Called by the transport just before the first body bytes are stored,
+    // with the size of the decoded body if the response announced it or zero.
+    virtual void ReserveBody(size_t expected_size) { result.body.reserve(expected_size); }
+    // Called by the transport each time more of the body has arrived.
+    virtual void BodyReceived() {}
+
+    std::vector<std::string> request_headers;
+    // let the server compress the body; it is decoded before it reaches result
+    bool accept_encoding { false };
+    FetchResult result;
+    TransferTiming timing;
+};
+
+// Moves bytes for the fetch engine, which keeps the scheduling, caching,
+// coalescing and retries so they behave the same over every transport. All
+// calls but Wakeup are made from the engine's I/O thread.
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    // Returns false if the request could not be started at all.
+    virtual bool Start(TransportRequest& request) = 0;
+    // Drops a started request without reporting it as completed.
+    virtual void Abort(TransportRequest& request) = 0;
+    // Makes progress on started requests and appends those that finished.
+    virtual void Perform(std::vector<TransportRequest*>& completed) = 0;
+    // Blocks until there may be progress to make, Wakeup is called or the timeout passes.
+    virtual void Wait(long timeout_ms) = 0;
+    virtual void Wakeup() = 0;
+
+    // Resolves the URL's host and opens a connection to it ahead of the first
+    // request there. Does nothing by default.
+    virtual void Preconnect(const std::string& url);
+
+    virtual PoolStats GetPoolStats() const;
+};
+
+}
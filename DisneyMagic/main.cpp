@@ -2,10 +2,16 @@
 #include <SFML/Graphics.hpp>
 #include "ResourcePath.hpp"
 #include "CurlHelpers.h"
+#include "CatalogSnapshot.h"
 #include "Container.h"
+#include "HandshakeBenchmark.h"
+#include "ParsePool.h"
+#include "SetResolver.h"
+#include "StartupBenchmark.h"
+#include "StartupGraph.h"
+#include <cstdlib>
 #include <iostream>
 #include <string>
-#include <rapidjson/document.h>
 #include <algorithm>
 #include <memory>
 
@@ -24,51 +30,124 @@ static const double image_height { 174.22 };
 // factor used to scale up the currently selected tile
 static const sf::Vector2f kScaleEnhancementFactor(1.033f, 1.033f);
 
+// with DISNEYMAGIC_BENCHMARK set the app times how long the home screen takes to fill, then exits;
+// set to "handshakes" it instead compares cold and resumed connection setup to the CDN hosts
+static const double kBenchmarkTimeoutSeconds { 60 };
+
 static const std::string home_api_url {"https://cd-static.bamgrid.com/dp-117731241344/home.json"};
+// tile images are served from here; connecting early saves the first row a round trip or two
+static const std::string image_host_url {"https://prod-ripcut-delivery.disney-plus.net/"};
 
-static std::string get_home_api()
+static disneymagic::Catalog get_home_catalog()
 {
     std::string home_api_contents;
-    curlhelpers::retrieve_file_from_URL(home_api_url, home_api_contents);
-    return home_api_contents;
+    curlhelpers::retrieve_file_from_URL(home_api_url, home_api_contents, curlhelpers::RequestKind::HomeApi);
+    // the catalog takes over the downloaded document, which its records point into
+    return disneymagic::CatalogExtractor().ExtractHome(std::move(home_api_contents));
 }
 
 static void populate_default_containers(
-    const std::string& home_api_contents,
+    const disneymagic::Catalog& catalog,
     sf::RenderWindow& window,
     const sf::Font& font,
-    rapidjson::Document& api_doc,
+    disneymagic::SetResolver& set_resolver,
     std::vector<std::unique_ptr<disneymagic::Container>>& containers)
 {
-    api_doc.Parse(home_api_contents.c_str());
+    const std::vector<disneymagic::CatalogContainer>& rows = catalog.Containers();
 
-    const auto& container_array = api_doc["data"]["StandardCollection"]["containers"].GetArray();
-    containers.reserve(container_array.Size());
+    containers.reserve(rows.size());
+    set_resolver.ResolveAll(rows, max_row_count);
 
-    disneymagic::ContainerFactory container_factory(window, font, image_width, image_height);
+    disneymagic::ContainerFactory container_factory(set_resolver, window, font, image_width, image_height);
     std::transform(
-        container_array.begin(),
-        container_array.begin() + std::min(max_row_count, (size_t)container_array.Size()),
+        rows.begin(),
+        rows.begin() + std::min(max_row_count, rows.size()),
         std::back_inserter(containers),
         container_factory);
 }
 
 static bool load_row(
     size_t row_index,
-    const rapidjson::Document& api_doc,
+    const std::vector<disneymagic::CatalogContainer>& catalog,
+    disneymagic::SetResolver& set_resolver,
     sf::RenderWindow& window,
     const sf::Font& font,
     std::vector<std::unique_ptr<disneymagic::Container>>& containers)
 {
-    const auto& container_array = api_doc["data"]["StandardCollection"]["containers"].GetArray();
-    if (row_index < container_array.Size() && row_index >= containers.size())
+    if (row_index < catalog.size() && row_index >= containers.size())
     {
-        containers.emplace_back(std::make_unique<disneymagic::Container>(container_array[row_index], window, font, image_width, image_height));
+        containers.emplace_back(std::make_unique<disneymagic::Container>(catalog[row_index], set_resolver, window, font, image_width, image_height));
         return true;
     }
     return false;
 }
 
+static void update_fetch_priorities(
+    size_t first_container_index,
+    const std::vector<int>& first_item_index_per_row,
+    std::vector<std::unique_ptr<disneymagic::Container>>& containers)
+{
+    for (size_t container_index = 0; container_index < containers.size(); ++container_index)
+    {
+        size_t row_distance { 0 };
+        if (container_index < first_container_index)
+        {
+            row_distance = first_container_index - container_index;
+        }
+        else if (container_index >= first_container_index + max_row_count)
+        {
+            row_distance = container_index - (first_container_index + max_row_count) + 1;
+        }
+        containers[container_index]->UpdateFetchPriorities(first_item_index_per_row[container_index], max_row_tile_count, row_distance);
+    }
+}
+
+static void report_fetch_stats()
+{
+    curlhelpers::EngineStats engine_stats = curlhelpers::FetchEngine::Instance().GetEngineStats();
+    std::cout << "Fetch engine: " << engine_stats.requests << " requests, "
+              << engine_stats.coalesced << " coalesced, "
+              << engine_stats.coalesced_bytes << " bytes saved by coalescing, "
+              << engine_stats.cancelled << " cancelled, "
+              << engine_stats.failures << " failed, "
+              << engine_stats.negative_hits << " failed from the negative cache, "
+              << engine_stats.retries << " retries, "
+              << engine_stats.hedges << " hedged ("
+              << engine_stats.hedge_wins << " won by the hedge)" << std::endl;
+
+    curlhelpers::PoolStats stats = curlhelpers::FetchEngine::Instance().GetPoolStats();
+    std::cout << "Connection pool: " << stats.handles_created << " handles created, "
+              << stats.handles_reused << " handles reused, "
+              << stats.connections_reused << " warm connections, "
+              << stats.new_connections << " new connections, "
+              << stats.tls_handshakes << " TLS handshakes, "
+              << stats.http2_transfers << " HTTP/2 transfers, "
+              << stats.http1_transfers << " HTTP/1.x transfers" << std::endl;
+
+    curlhelpers::LimiterStats limiter_stats = curlhelpers::FetchEngine::Instance().GetLimiterStats();
+    std::cout << "Concurrency limiter: window " << limiter_stats.window << ", "
+              << limiter_stats.increases << " increases, "
+              << limiter_stats.decreases << " decreases, "
+              << limiter_stats.throughput_bytes_per_second << " bytes/s, "
+              << limiter_stats.smoothed_first_byte_seconds << "s smoothed first byte" << std::endl;
+
+    curlhelpers::BufferStats buffer_stats = curlhelpers::FetchEngine::Instance().GetBufferStats();
+    std::cout << "Receive buffers: " << buffer_stats.acquired << " acquired, "
+              << buffer_stats.reused << " reused, "
+              << buffer_stats.allocations << " allocations, "
+              << buffer_stats.recycled << " recycled" << std::endl;
+
+    curlhelpers::CacheStats cache_stats = curlhelpers::FetchEngine::Instance().GetCacheStats();
+    std::cout << "Disk cache: " << cache_stats.fresh_hits << " fresh hits, "
+              << cache_stats.stale_hits << " stale hits, "
+              << cache_stats.misses << " misses, "
+              << cache_stats.revalidated << " revalidated, "
+              << cache_stats.replaced << " replaced, "
+              << cache_stats.evictions << " evictions" << std::endl;
+
+    curlhelpers::FetchEngine::Instance().ReportMetrics(std::cout);
+}
+
 static void initialize_display(sf::RenderWindow& window, sf::Font& font)
 {
     window.create(sf::VideoMode(1600, 1200), "Disney+");
@@ -91,14 +170,60 @@ static void initialize_display(sf::RenderWindow& window, sf::Font& font)
 
 int main()
 {
+    const char* benchmark_name = std::getenv("DISNEYMAGIC_BENCHMARK");
+    if (benchmark_name != nullptr && std::string(benchmark_name) == "handshakes")
+    {
+        curlhelpers::HandshakeBenchmark::Run({ home_api_url, image_host_url }, std::cout);
+        return EXIT_SUCCESS;
+    }
+
+    std::unique_ptr<disneymagic::StartupBenchmark> benchmark;
+    if (benchmark_name != nullptr)
+    {
+        benchmark = std::make_unique<disneymagic::StartupBenchmark>(kBenchmarkTimeoutSeconds);
+    }
+
     sf::RenderWindow window;
     sf::Font font;
     std::vector<std::unique_ptr<disneymagic::Container>> containers;
-    rapidjson::Document api_doc;
+    disneymagic::Catalog catalog;
+    // set documents are extracted on the parse pool, the home API on its startup phase's thread
+    disneymagic::SetResolver set_resolver(std::make_shared<disneymagic::ParsePool>());
+    bool from_snapshot { false };
+    disneymagic::StartupGraph startup;
     try
     {
-        initialize_display(window, font);
-        populate_default_containers(get_home_api(), window, font, api_doc, containers);
+        // the network phases run while the window opens and the font loads
+        using Affinity = disneymagic::StartupGraph::Affinity;
+        startup.Add("fetch engine", {}, Affinity::AnyThread, []
+        {
+            curlhelpers::FetchEngine::Instance();
+        });
+        // the last launch's snapshot fills the rows straight from disk; the network only when there is none
+        startup.Add("catalog snapshot", {}, Affinity::AnyThread, [&catalog, &from_snapshot]
+        {
+            from_snapshot = disneymagic::CatalogSnapshot::Load(disneymagic::CatalogSnapshot::DefaultPath(), catalog);
+        });
+        startup.Add("home api", { "fetch engine", "catalog snapshot" }, Affinity::AnyThread, [&catalog, &from_snapshot]
+        {
+            if (!from_snapshot)
+            {
+                catalog = get_home_catalog();
+            }
+        });
+        startup.Add("image host", { "fetch engine" }, Affinity::AnyThread, []
+        {
+            curlhelpers::FetchEngine::Instance().Preconnect(image_host_url);
+        });
+        startup.Add("display", {}, Affinity::MainThread, [&window, &font]
+        {
+            initialize_display(window, font);
+        });
+        startup.Add("containers", { "home api", "display" }, Affinity::MainThread, [&]
+        {
+            populate_default_containers(catalog, window, font, set_resolver, containers);
+        });
+        startup.Run();
     }
     catch(std::exception& e)
     {
@@ -111,9 +236,13 @@ int main()
         return EXIT_FAILURE;
     }
 
+    // refreshes the snapshot for the next launch while this one runs
+    disneymagic::CatalogRefresh catalog_refresh(home_api_url, disneymagic::CatalogSnapshot::DefaultPath());
+
     std::vector<int> first_item_index_per_row(containers.capacity(), 0);
     int cursor_position { 0 };
     int first_container_index { 0 };
+    update_fetch_priorities(first_container_index, first_item_index_per_row, containers);
 
     while (window.isOpen())
     {
@@ -137,6 +266,11 @@ int main()
                             window.close();
                             break;
                         }
+                        case sf::Keyboard::S:
+                        {
+                            report_fetch_stats();
+                            break;
+                        }
                         case sf::Keyboard::Left:
                         {
                             if (cursor_position % max_row_tile_count > 0)
@@ -194,7 +328,7 @@ int main()
                             }
                             else
                             {
-                                if (load_row(first_container_index + max_row_count, api_doc, window, font, containers) ||
+                                if (load_row(first_container_index + max_row_count, catalog.Containers(), set_resolver, window, font, containers) ||
                                     first_container_index < containers.size() - max_row_count)
                                 {
                                     ++first_container_index;
@@ -204,9 +338,16 @@ int main()
                         }
                         default: break;
                     }
+                    update_fetch_priorities(first_container_index, first_item_index_per_row, containers);
                 }
             }
 
+            // rows off screen still finish their fetches and resume their prefetches
+            for (auto& container : containers)
+            {
+                container->Update();
+            }
+
             // Clear the display
             window.clear();
 
@@ -255,6 +396,13 @@ int main()
 
             // Update display
             window.display();
+
+            if (benchmark && benchmark->Update(containers, first_container_index, first_item_index_per_row, max_row_count, max_row_tile_count))
+            {
+                benchmark->Report(std::cout);
+                startup.Report(std::cout);
+                window.close();
+            }
         }
         catch(std::exception& e)
         {
@@ -268,5 +416,6 @@ int main()
         }
     }
 
+    report_fetch_stats();
     return EXIT_SUCCESS;
 }